@@ -70,13 +70,14 @@ LG_RendererRotate;
 
 typedef struct LG_RendererFormat
 {
-  FrameType         type;    // frame type
-  unsigned int      width;   // image width
-  unsigned int      height;  // image height
-  unsigned int      stride;  // scanline width (zero if compresed)
-  unsigned int      pitch;   // scanline bytes (or compressed size)
-  unsigned int      bpp;     // bits per pixel (zero if compressed)
-  LG_RendererRotate rotate;  // guest rotation
+  FrameType         type;        // frame type
+  FrameCompression  compression; // frame data compression
+  unsigned int      width;       // image width
+  unsigned int      height;      // image height
+  unsigned int      stride;      // scanline width (of the decoded image)
+  unsigned int      pitch;       // scanline bytes (of the decoded image)
+  unsigned int      bpp;         // bits per pixel
+  LG_RendererRotate rotate;      // guest rotation
 }
 LG_RendererFormat;
 
@@ -110,16 +111,17 @@ typedef void         (* LG_RendererDeInitialize )(void * opaque);
 typedef bool         (* LG_RendererSupports     )(void * opaque, LG_RendererSupport support);
 typedef void         (* LG_RendererOnRestart    )(void * opaque);
 typedef void         (* LG_RendererOnResize     )(void * opaque, const int width, const int height, const double scale, const LG_RendererRect destRect, LG_RendererRotate rotate);
-typedef bool         (* LG_RendererOnMouseShape )(void * opaque, const LG_RendererCursor cursor, const int width, const int height, const int pitch, const uint8_t * data);
+typedef bool         (* LG_RendererOnMouseShape )(void * opaque, const LG_RendererCursor cursor, const int width, const int height, const int pitch, const uint8_t * data, const uint64_t id);
+typedef bool         (* LG_RendererOnMouseShapeID)(void * opaque, const uint64_t id);
 typedef bool         (* LG_RendererOnMouseEvent )(void * opaque, const bool visible , const int x, const int y);
 typedef bool         (* LG_RendererOnFrameFormat)(void * opaque, const LG_RendererFormat format, bool useDMA);
-typedef bool         (* LG_RendererOnFrame      )(void * opaque, const FrameBuffer * frame, int dmaFD);
+typedef bool         (* LG_RendererOnFrame      )(void * opaque, const FrameBuffer * frame, int dmaFD, const FrameDamageRect * damageRects, int damageRectsCount);
 typedef void         (* LG_RendererOnAlert      )(void * opaque, const LG_MsgAlert alert, const char * message, bool ** closeFlag);
 typedef void         (* LG_RendererOnHelp       )(void * opaque, const char * message);
 typedef void         (* LG_RendererOnShowFPS    )(void * opaque, bool showFPS);
 typedef bool         (* LG_RendererRenderStartup)(void * opaque);
 typedef bool         (* LG_RendererRender       )(void * opaque, LG_RendererRotate rotate);
-typedef void         (* LG_RendererUpdateFPS    )(void * opaque, const float avgUPS, const float avgFPS);
+typedef void         (* LG_RendererUpdateFPS    )(void * opaque, const float avgUPS, const float avgFPS, const float avgLatency, const uint64_t drops, const char * hostStats);
 
 typedef struct LG_Renderer
 {
@@ -133,6 +135,7 @@ typedef struct LG_Renderer
   LG_RendererOnRestart      on_restart;
   LG_RendererOnResize       on_resize;
   LG_RendererOnMouseShape   on_mouse_shape;
+  LG_RendererOnMouseShapeID on_mouse_shape_id; // optional, false if the shape is not cached
   LG_RendererOnMouseEvent   on_mouse_event;
   LG_RendererOnFrameFormat  on_frame_format;
   LG_RendererOnFrame        on_frame;
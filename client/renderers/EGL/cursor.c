@@ -34,15 +34,31 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "cursor_rgb.frag.h"
 #include "cursor_mono.frag.h"
 
+// the number of uploaded shapes kept for reuse
+#define CURSOR_CACHE_SIZE 8
+
 struct CursorTex
 {
-  struct EGL_Texture * texture;
   struct EGL_Shader  * shader;
   GLuint uMousePos;
   GLuint uRotate;
   GLuint uCBMode;
 };
 
+struct CursorShape
+{
+  uint64_t           id;      // zero if the entry is unused
+  LG_RendererCursor  type;
+  int                width;
+  int                height;  // as given to egl_cursor_set_shape
+  unsigned int       lastUse;
+
+  // the color texture, or the AND mask of monochrome cursors
+  struct EGL_Texture * norm;
+  // the XOR mask of monochrome cursors
+  struct EGL_Texture * mono;
+};
+
 struct EGL_Cursor
 {
   LG_Lock           lock;
@@ -52,8 +68,14 @@ struct EGL_Cursor
   int               stride;
   uint8_t *         data;
   size_t            dataSize;
+  uint64_t          id;
+  bool              cached; // the pending update is a shape already uploaded
   bool              update;
 
+  struct CursorShape   shapes[CURSOR_CACHE_SIZE];
+  struct CursorShape * shape; // the current shape
+  unsigned int         useCount;
+
   // cursor state
   bool              visible;
   float             x, y, w, h;
@@ -69,12 +91,6 @@ static bool egl_cursor_tex_init(struct CursorTex * t,
     const char * vertex_code  , size_t vertex_size,
     const char * fragment_code, size_t fragment_size)
 {
-  if (!egl_texture_init(&t->texture, NULL))
-  {
-    DEBUG_ERROR("Failed to initialize the cursor texture");
-    return false;
-  }
-
   if (!egl_shader_init(&t->shader))
   {
     DEBUG_ERROR("Failed to initialize the cursor shader");
@@ -113,8 +129,7 @@ static inline void egl_cursor_tex_uniforms(EGL_Cursor * cursor, struct CursorTex
 
 static void egl_cursor_tex_free(struct CursorTex * t)
 {
-  egl_texture_free(&t->texture);
-  egl_shader_free (&t->shader );
+  egl_shader_free(&t->shader);
 };
 
 bool egl_cursor_init(EGL_Cursor ** cursor)
@@ -147,6 +162,17 @@ bool egl_cursor_init(EGL_Cursor ** cursor)
 
   egl_model_set_default((*cursor)->model);
 
+  for(int i = 0; i < CURSOR_CACHE_SIZE; ++i)
+  {
+    struct CursorShape * shape = &(*cursor)->shapes[i];
+    if (!egl_texture_init(&shape->norm, NULL) ||
+        !egl_texture_init(&shape->mono, NULL))
+    {
+      DEBUG_ERROR("Failed to initialize the cursor texture");
+      return false;
+    }
+  }
+
   (*cursor)->cbMode = option_get_int("egl", "cbMode");
 
   return true;
@@ -165,15 +191,24 @@ void egl_cursor_free(EGL_Cursor ** cursor)
   egl_cursor_tex_free(&(*cursor)->mono);
   egl_model_free(&(*cursor)->model);
 
+  for(int i = 0; i < CURSOR_CACHE_SIZE; ++i)
+  {
+    egl_texture_free(&(*cursor)->shapes[i].norm);
+    egl_texture_free(&(*cursor)->shapes[i].mono);
+  }
+
   free(*cursor);
   *cursor = NULL;
 }
 
 bool egl_cursor_set_shape(EGL_Cursor * cursor, const LG_RendererCursor type,
-    const int width, const int height, const int stride, const uint8_t * data)
+    const int width, const int height, const int stride, const uint8_t * data,
+    const uint64_t id)
 {
   LG_LOCK(cursor->lock);
 
+  cursor->id     = id;
+  cursor->cached = false;
   cursor->type   = type;
   cursor->width  = width;
   cursor->height = (type == LG_CURSOR_MONOCHROME ? height / 2 : height);
@@ -189,6 +224,8 @@ bool egl_cursor_set_shape(EGL_Cursor * cursor, const LG_RendererCursor type,
     if (!cursor->data)
     {
       DEBUG_ERROR("Failed to malloc buffer for cursor shape");
+      cursor->dataSize = 0;
+      LG_UNLOCK(cursor->lock);
       return false;
     }
 
@@ -202,6 +239,102 @@ bool egl_cursor_set_shape(EGL_Cursor * cursor, const LG_RendererCursor type,
   return true;
 }
 
+bool egl_cursor_set_shape_id(EGL_Cursor * cursor, const uint64_t id,
+    int * width, int * height)
+{
+  if (!id)
+    return false;
+
+  LG_LOCK(cursor->lock);
+
+  /* entries are only replaced by the render thread while processing the
+   * latest request, so a match here stays valid until it is used */
+  for(int i = 0; i < CURSOR_CACHE_SIZE; ++i)
+  {
+    const struct CursorShape * shape = &cursor->shapes[i];
+    if (shape->id != id)
+      continue;
+
+    *width         = shape->width;
+    *height        = shape->height;
+    cursor->id     = id;
+    cursor->cached = true;
+    cursor->update = true;
+
+    LG_UNLOCK(cursor->lock);
+    return true;
+  }
+
+  LG_UNLOCK(cursor->lock);
+  return false;
+}
+
+static struct CursorShape * egl_cursor_find_shape(EGL_Cursor * cursor,
+    const uint64_t id)
+{
+  struct CursorShape * lru = &cursor->shapes[0];
+  for(int i = 0; i < CURSOR_CACHE_SIZE; ++i)
+  {
+    struct CursorShape * shape = &cursor->shapes[i];
+    if (id && shape->id == id)
+      return shape;
+
+    if (shape->lastUse < lru->lastUse)
+      lru = shape;
+  }
+
+  return lru;
+}
+
+static void egl_cursor_upload(EGL_Cursor * cursor, struct CursorShape * shape)
+{
+  uint8_t * data = cursor->data;
+
+  shape->id     = cursor->id;
+  shape->type   = cursor->type;
+  shape->width  = cursor->width;
+  shape->height = cursor->type == LG_CURSOR_MONOCHROME ?
+    cursor->height * 2 : cursor->height;
+
+  switch(cursor->type)
+  {
+    case LG_CURSOR_MASKED_COLOR:
+      // fall through
+
+    case LG_CURSOR_COLOR:
+    {
+      egl_texture_setup(shape->norm, EGL_PF_BGRA, cursor->width, cursor->height, cursor->stride, false, false);
+      egl_texture_update(shape->norm, data);
+      break;
+    }
+
+    case LG_CURSOR_MONOCHROME:
+    {
+      uint32_t and[cursor->width * cursor->height];
+      uint32_t xor[cursor->width * cursor->height];
+
+      for(int y = 0; y < cursor->height; ++y)
+        for(int x = 0; x < cursor->width; ++x)
+        {
+          const uint8_t  * srcAnd  = data + (cursor->stride * y) + (x / 8);
+          const uint8_t  * srcXor  = srcAnd + cursor->stride * cursor->height;
+          const uint8_t    mask    = 0x80 >> (x % 8);
+          const uint32_t   andMask = (*srcAnd & mask) ? 0xFFFFFFFF : 0xFF000000;
+          const uint32_t   xorMask = (*srcXor & mask) ? 0x00FFFFFF : 0x00000000;
+
+          and[y * cursor->width + x] = andMask;
+          xor[y * cursor->width + x] = xorMask;
+        }
+
+      egl_texture_setup (shape->norm, EGL_PF_BGRA, cursor->width, cursor->height, cursor->width * 4, false, false);
+      egl_texture_setup (shape->mono, EGL_PF_BGRA, cursor->width, cursor->height, cursor->width * 4, false, false);
+      egl_texture_update(shape->norm, (uint8_t *)and);
+      egl_texture_update(shape->mono, (uint8_t *)xor);
+      break;
+    }
+  }
+}
+
 void egl_cursor_set_size(EGL_Cursor * cursor, const float w, const float h)
 {
   cursor->w = w;
@@ -235,72 +368,48 @@ void egl_cursor_render(EGL_Cursor * cursor, LG_RendererRotate rotate)
     LG_LOCK(cursor->lock);
     cursor->update = false;
 
-    uint8_t * data = cursor->data;
+    /* a shape that was already uploaded only needs to be selected, the
+     * data of an uncached shape replaces the least recently used entry */
+    struct CursorShape * shape = egl_cursor_find_shape(cursor, cursor->id);
+    if (!cursor->cached)
+      egl_cursor_upload(cursor, shape);
 
-    switch(cursor->type)
+    if (shape->id == cursor->id)
     {
-      case LG_CURSOR_MASKED_COLOR:
-        // fall through
-
-      case LG_CURSOR_COLOR:
-      {
-        egl_texture_setup(cursor->norm.texture, EGL_PF_BGRA, cursor->width, cursor->height, cursor->stride, false, false);
-        egl_texture_update(cursor->norm.texture, data);
-        egl_model_set_texture(cursor->model, cursor->norm.texture);
-        break;
-      }
-
-      case LG_CURSOR_MONOCHROME:
-      {
-        uint32_t and[cursor->width * cursor->height];
-        uint32_t xor[cursor->width * cursor->height];
-
-        for(int y = 0; y < cursor->height; ++y)
-          for(int x = 0; x < cursor->width; ++x)
-          {
-            const uint8_t  * srcAnd  = data + (cursor->stride * y) + (x / 8);
-            const uint8_t  * srcXor  = srcAnd + cursor->stride * cursor->height;
-            const uint8_t    mask    = 0x80 >> (x % 8);
-            const uint32_t   andMask = (*srcAnd & mask) ? 0xFFFFFFFF : 0xFF000000;
-            const uint32_t   xorMask = (*srcXor & mask) ? 0x00FFFFFF : 0x00000000;
-
-            and[y * cursor->width + x] = andMask;
-            xor[y * cursor->width + x] = xorMask;
-          }
-
-        egl_texture_setup (cursor->norm.texture, EGL_PF_BGRA, cursor->width, cursor->height, cursor->width * 4, false, false);
-        egl_texture_setup (cursor->mono.texture, EGL_PF_BGRA, cursor->width, cursor->height, cursor->width * 4, false, false);
-        egl_texture_update(cursor->norm.texture, (uint8_t *)and);
-        egl_texture_update(cursor->mono.texture, (uint8_t *)xor);
-        break;
-      }
+      shape->lastUse = ++cursor->useCount;
+      cursor->shape  = shape;
     }
     LG_UNLOCK(cursor->lock);
   }
 
+  if (!cursor->shape)
+    return;
+
+  const struct CursorShape * shape = cursor->shape;
   cursor->rotate = rotate;
 
   glEnable(GL_BLEND);
-  switch(cursor->type)
+  switch(shape->type)
   {
     case LG_CURSOR_MONOCHROME:
     {
       egl_shader_use(cursor->norm.shader);
       egl_cursor_tex_uniforms(cursor, &cursor->norm, true);;
       glBlendFunc(GL_ZERO, GL_SRC_COLOR);
-      egl_model_set_texture(cursor->model, cursor->norm.texture);
+      egl_model_set_texture(cursor->model, shape->norm);
       egl_model_render(cursor->model);
 
       egl_shader_use(cursor->mono.shader);
       egl_cursor_tex_uniforms(cursor, &cursor->mono, true);;
       glBlendFunc(GL_ONE_MINUS_DST_COLOR, GL_ZERO);
-      egl_model_set_texture(cursor->model, cursor->mono.texture);
+      egl_model_set_texture(cursor->model, shape->mono);
       egl_model_render(cursor->model);
       break;
     }
 
     case LG_CURSOR_COLOR:
     {
+      egl_model_set_texture(cursor->model, shape->norm);
       egl_shader_use(cursor->norm.shader);
       egl_cursor_tex_uniforms(cursor, &cursor->norm, false);
       glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
@@ -310,6 +419,7 @@ void egl_cursor_render(EGL_Cursor * cursor, LG_RendererRotate rotate)
 
     case LG_CURSOR_MASKED_COLOR:
     {
+      egl_model_set_texture(cursor->model, shape->norm);
       egl_shader_use(cursor->mono.shader);
       egl_cursor_tex_uniforms(cursor, &cursor->mono, false);
       glBlendFunc(GL_ONE_MINUS_DST_COLOR, GL_ZERO);
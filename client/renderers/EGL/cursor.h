@@ -39,7 +39,12 @@ bool egl_cursor_set_shape(
     const int width,
     const int height,
     const int stride,
-    const uint8_t * data);
+    const uint8_t * data,
+    const uint64_t id);
+
+/* select a previously uploaded shape, returns false if it is not cached */
+bool egl_cursor_set_shape_id(EGL_Cursor * cursor, const uint64_t id,
+    int * width, int * height);
 
 void egl_cursor_set_size(EGL_Cursor * cursor, const float x, const float y);
 
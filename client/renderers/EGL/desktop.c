@@ -34,6 +34,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "desktop.vert.h"
 #include "desktop_rgb.frag.h"
 #include "desktop_rgb.def.h"
+#include "desktop_yuv.frag.h"
 
 struct DesktopShader
 {
@@ -56,10 +57,12 @@ struct EGL_Desktop
 
   // internals
   int               width, height;
+  FrameCompression  compression;
   LG_RendererRotate rotate;
 
   // shader instances
   struct DesktopShader shader_generic;
+  struct DesktopShader shader_yuv;
 
   // scale algorithm
   int scaleAlgo;
@@ -130,6 +133,16 @@ bool egl_desktop_init(EGL_Desktop ** desktop, EGLDisplay * display)
     return false;
   }
 
+  if (!egl_init_desktop_shader(
+    &(*desktop)->shader_yuv,
+    b_shader_desktop_vert    , b_shader_desktop_vert_size,
+    b_shader_desktop_yuv_frag, b_shader_desktop_yuv_frag_size))
+  {
+    DEBUG_ERROR("Failed to initialize the yuv desktop shader");
+    return false;
+  }
+  egl_shader_associate_textures((*desktop)->shader_yuv.shader, 2);
+
   if (!egl_model_init(&(*desktop)->model))
   {
     DEBUG_ERROR("Failed to initialize the desktop model");
@@ -202,6 +215,7 @@ void egl_desktop_free(EGL_Desktop ** desktop)
 
   egl_texture_free(&(*desktop)->texture              );
   egl_shader_free (&(*desktop)->shader_generic.shader);
+  egl_shader_free (&(*desktop)->shader_yuv.shader    );
   egl_model_free  (&(*desktop)->model                );
 
   free(*desktop);
@@ -233,13 +247,19 @@ bool egl_desktop_setup(EGL_Desktop * desktop, const LG_RendererFormat format, bo
       desktop->shader = &desktop->shader_generic;
       break;
 
+    case FRAME_TYPE_NV12:
+      pixFmt = EGL_PF_NV12;
+      desktop->shader = &desktop->shader_yuv;
+      break;
+
     default:
       DEBUG_ERROR("Unsupported frame format");
       return false;
   }
 
-  desktop->width  = format.width;
-  desktop->height = format.height;
+  desktop->width       = format.width;
+  desktop->height      = format.height;
+  desktop->compression = format.compression;
 
   if (!egl_texture_setup(
     desktop->texture,
@@ -258,7 +278,8 @@ bool egl_desktop_setup(EGL_Desktop * desktop, const LG_RendererFormat format, bo
   return true;
 }
 
-bool egl_desktop_update(EGL_Desktop * desktop, const FrameBuffer * frame, int dmaFd)
+bool egl_desktop_update(EGL_Desktop * desktop, const FrameBuffer * frame, int dmaFd,
+    const FrameDamageRect * damageRects, int damageRectsCount)
 {
   if (dmaFd >= 0)
   {
@@ -267,7 +288,8 @@ bool egl_desktop_update(EGL_Desktop * desktop, const FrameBuffer * frame, int dm
   }
   else
   {
-    if (!egl_texture_update_from_frame(desktop->texture, frame))
+    if (!egl_texture_update_from_frame(desktop->texture, frame,
+        desktop->compression, damageRects, damageRectsCount))
       return false;
   }
 
@@ -481,11 +481,12 @@ void egl_on_resize(void * opaque, const int width, const int height, const doubl
 
 bool egl_on_mouse_shape(void * opaque, const LG_RendererCursor cursor,
     const int width, const int height,
-    const int pitch, const uint8_t * data)
+    const int pitch, const uint8_t * data, const uint64_t id)
 {
   struct Inst * this = (struct Inst *)opaque;
 
-  if (!egl_cursor_set_shape(this->cursor, cursor, width, height, pitch, data))
+  if (!egl_cursor_set_shape(this->cursor, cursor, width, height, pitch, data,
+        id))
   {
     DEBUG_ERROR("Failed to update the cursor shape");
     return false;
@@ -498,6 +499,21 @@ bool egl_on_mouse_shape(void * opaque, const LG_RendererCursor cursor,
   return true;
 }
 
+bool egl_on_mouse_shape_id(void * opaque, const uint64_t id)
+{
+  struct Inst * this = (struct Inst *)opaque;
+
+  int width, height;
+  if (!egl_cursor_set_shape_id(this->cursor, id, &width, &height))
+    return false;
+
+  this->mouseWidth  = width;
+  this->mouseHeight = height;
+  egl_calc_mouse_size(this);
+
+  return true;
+}
+
 bool egl_on_mouse_event(void * opaque, const bool visible, const int x, const int y)
 {
   struct Inst * this = (struct Inst *)opaque;
@@ -539,11 +555,13 @@ bool egl_on_frame_format(void * opaque, const LG_RendererFormat format, bool use
   return egl_desktop_setup(this->desktop, format, useDMA);
 }
 
-bool egl_on_frame(void * opaque, const FrameBuffer * frame, int dmaFd)
+bool egl_on_frame(void * opaque, const FrameBuffer * frame, int dmaFd,
+    const FrameDamageRect * damageRects, int damageRectsCount)
 {
   struct Inst * this = (struct Inst *)opaque;
 
-  if (!egl_desktop_update(this->desktop, frame, dmaFd))
+  if (!egl_desktop_update(this->desktop, frame, dmaFd, damageRects,
+        damageRectsCount))
   {
     DEBUG_INFO("Failed to to update the desktop");
     return false;
@@ -869,31 +887,33 @@ bool egl_render(void * opaque, LG_RendererRotate rotate)
   return true;
 }
 
-void egl_update_fps(void * opaque, const float avgUPS, const float avgFPS)
+void egl_update_fps(void * opaque, const float avgUPS, const float avgFPS,
+    const float avgLatency, const uint64_t drops, const char * hostStats)
 {
   struct Inst * this = (struct Inst *)opaque;
-  egl_fps_update(this->fps, avgUPS, avgFPS);
+  egl_fps_update(this->fps, avgUPS, avgFPS, avgLatency, drops, hostStats);
   this->cursorLastValid = false;
 }
 
 struct LG_Renderer LGR_EGL =
 {
-  .get_name        = egl_get_name,
-  .setup           = egl_setup,
-  .create          = egl_create,
-  .initialize      = egl_initialize,
-  .deinitialize    = egl_deinitialize,
-  .supports        = egl_supports,
-  .on_restart      = egl_on_restart,
-  .on_resize       = egl_on_resize,
-  .on_mouse_shape  = egl_on_mouse_shape,
-  .on_mouse_event  = egl_on_mouse_event,
-  .on_frame_format = egl_on_frame_format,
-  .on_frame        = egl_on_frame,
-  .on_alert        = egl_on_alert,
-  .on_help         = egl_on_help,
-  .on_show_fps     = egl_on_show_fps,
-  .render_startup  = egl_render_startup,
-  .render          = egl_render,
-  .update_fps      = egl_update_fps
+  .get_name          = egl_get_name,
+  .setup             = egl_setup,
+  .create            = egl_create,
+  .initialize        = egl_initialize,
+  .deinitialize      = egl_deinitialize,
+  .supports          = egl_supports,
+  .on_restart        = egl_on_restart,
+  .on_resize         = egl_on_resize,
+  .on_mouse_shape    = egl_on_mouse_shape,
+  .on_mouse_shape_id = egl_on_mouse_shape_id,
+  .on_mouse_event    = egl_on_mouse_event,
+  .on_frame_format   = egl_on_frame_format,
+  .on_frame          = egl_on_frame,
+  .on_alert          = egl_on_alert,
+  .on_help           = egl_on_help,
+  .on_show_fps       = egl_on_show_fps,
+  .render_startup    = egl_render_startup,
+  .render            = egl_render,
+  .update_fps        = egl_update_fps
 };
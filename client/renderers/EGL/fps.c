@@ -143,13 +143,17 @@ void egl_fps_set_font(EGL_FPS * fps, LG_Font * fontObj)
   fps->fontObj = fontObj;
 }
 
-void egl_fps_update(EGL_FPS * fps, const float avgFPS, const float renderFPS)
+void egl_fps_update(EGL_FPS * fps, const float avgFPS, const float renderFPS,
+    const float avgLatency, const uint64_t drops, const char * hostStats)
 {
   if (!fps->display)
     return;
 
-  char str[128];
-  snprintf(str, sizeof(str), "UPS: %8.4f, FPS: %8.4f", avgFPS, renderFPS);
+  char str[256];
+  snprintf(str, sizeof(str),
+      "UPS: %8.4f, FPS: %8.4f, Latency: %6.2f ms, Dropped: %" PRIu64 "%s%s",
+      avgFPS, renderFPS, avgLatency, drops,
+      hostStats ? "\n" : "", hostStats ? hostStats : "");
 
   LG_FontBitmap * bmp = fps->font->render(fps->fontObj, 0xffffff00, str);
   if (!bmp)
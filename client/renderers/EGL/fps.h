@@ -20,6 +20,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "interface/font.h"
 
@@ -30,5 +31,6 @@ void egl_fps_free(EGL_FPS ** fps);
 
 void egl_fps_set_display(EGL_FPS * fps, bool display);
 void egl_fps_set_font   (EGL_FPS * fps, LG_Font * fontObj);
-void egl_fps_update(EGL_FPS * fps, const float avgUPS, const float avgFPS);
+void egl_fps_update(EGL_FPS * fps, const float avgUPS, const float avgFPS,
+    const float avgLatency, const uint64_t drops, const char * hostStats);
 void egl_fps_render(EGL_FPS * fps, const float scaleX, const float scaleY);
\ No newline at end of file
@@ -20,6 +20,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "texture.h"
 #include "common/debug.h"
 #include "common/framebuffer.h"
+#include "common/KVMFR.h"
 #include "egl_dynprocs.h"
 #include "egldebug.h"
 
@@ -48,6 +49,10 @@ struct Buffer
   GLuint   pbo;
   void *   map;
   GLsync   sync;
+
+  /* the areas of the buffer that were updated, zero for the full buffer */
+  unsigned int    damageRectsCount;
+  FrameDamageRect damageRects[KVMFR_MAX_DAMAGE_RECTS];
 };
 
 struct BufferState
@@ -64,6 +69,7 @@ struct EGL_Texture
   bool   streaming;
   bool   dma;
   bool   ready;
+  bool   fullUpdate;
 
   GLuint       sampler;
   size_t       width, height, stride, pitch;
@@ -76,6 +82,7 @@ struct EGL_Texture
   struct BufferState state;
   int             bufferCount;
   GLuint          tex;
+  GLuint          texUV; // the chroma plane of NV12 textures
   struct Buffer   buf[BUFFER_COUNT];
 
   size_t dmaImageCount;
@@ -130,6 +137,8 @@ void egl_texture_free(EGL_Texture ** texture)
   }
   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
   glDeleteTextures(1, &(*texture)->tex);
+  if ((*texture)->texUV)
+    glDeleteTextures(1, &(*texture)->texUV);
 
   for (size_t i = 0; i < (*texture)->dmaImageUsed; ++i)
     eglDestroyImage((*texture)->display, (*texture)->dmaImages[i].image);
@@ -197,6 +206,7 @@ bool egl_texture_setup(EGL_Texture * texture, enum EGL_PixelFormat pixFmt, size_
   texture->bufferCount = streaming ? BUFFER_COUNT : 1;
   texture->dma         = useDMA;
   texture->ready       = false;
+  texture->fullUpdate  = true;
 
   atomic_store_explicit(&texture->state.w, 0, memory_order_relaxed);
   atomic_store_explicit(&texture->state.u, 0, memory_order_relaxed);
@@ -241,6 +251,16 @@ bool egl_texture_setup(EGL_Texture * texture, enum EGL_PixelFormat pixFmt, size_
       texture->pboBufferSize = height * stride;
       break;
 
+    case EGL_PF_NV12:
+      // the Y plane, the UV plane follows it at half the height
+      texture->bpp           = 1;
+      texture->format        = GL_RED;
+      texture->intFormat     = GL_R8;
+      texture->dataType      = GL_UNSIGNED_BYTE;
+      texture->fourcc        = 0;
+      texture->pboBufferSize = (height + (height + 1) / 2) * stride;
+      break;
+
     default:
       DEBUG_ERROR("Unsupported pixel format");
       return false;
@@ -279,6 +299,20 @@ bool egl_texture_setup(EGL_Texture * texture, enum EGL_PixelFormat pixFmt, size_
   glBindTexture(GL_TEXTURE_2D, texture->tex);
   glTexImage2D(GL_TEXTURE_2D, 0, texture->intFormat, texture->width,
     texture->height, 0, texture->format, texture->dataType, NULL);
+
+  if (texture->texUV)
+  {
+    glDeleteTextures(1, &texture->texUV);
+    texture->texUV = 0;
+  }
+
+  if (pixFmt == EGL_PF_NV12)
+  {
+    glGenTextures(1, &texture->texUV);
+    glBindTexture(GL_TEXTURE_2D, texture->texUV);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, (texture->width + 1) / 2,
+      (texture->height + 1) / 2, 0, GL_RG, GL_UNSIGNED_BYTE, NULL);
+  }
   glBindTexture(GL_TEXTURE_2D, 0);
 
   if (!streaming)
@@ -346,7 +380,9 @@ bool egl_texture_update(EGL_Texture * texture, const uint8_t * buffer)
   return true;
 }
 
-bool egl_texture_update_from_frame(EGL_Texture * texture, const FrameBuffer * frame)
+bool egl_texture_update_from_frame(EGL_Texture * texture, const FrameBuffer * frame,
+    FrameCompression compression, const FrameDamageRect * damageRects,
+    int damageRectsCount)
 {
   if (!texture->streaming)
     return false;
@@ -356,21 +392,89 @@ bool egl_texture_update_from_frame(EGL_Texture * texture, const FrameBuffer * fr
 
   if (atomic_load_explicit(&texture->state.u, memory_order_acquire) == (uint8_t)(sw + 1))
   {
+    /* the damage of this frame is lost, the next update must be complete */
+    texture->fullUpdate = true;
     egl_warn_slow();
     return true;
   }
 
-  const uint8_t b = sw % BUFFER_COUNT;
+  const uint8_t   b   = sw % BUFFER_COUNT;
+  struct Buffer * buf = &texture->buf[b];
 
-  framebuffer_read(
-    frame,
-    texture->buf[b].map,
-    texture->stride,
-    texture->height,
-    texture->width,
-    texture->bpp,
-    texture->stride
-  );
+  if (compression == FRAME_COMPRESSION_RLE)
+  {
+    /* the whole frame is decoded, the damage only limits the upload */
+    framebuffer_read_rle(
+      frame,
+      buf->map,
+      texture->stride,
+      texture->height,
+      texture->width,
+      texture->bpp
+    );
+
+    if (texture->fullUpdate || damageRectsCount <= 0 ||
+        damageRectsCount > KVMFR_MAX_DAMAGE_RECTS)
+      buf->damageRectsCount = 0;
+    else
+    {
+      buf->damageRectsCount = damageRectsCount;
+      memcpy(buf->damageRects, damageRects,
+          damageRectsCount * sizeof(FrameDamageRect));
+    }
+    texture->fullUpdate = false;
+  }
+  else if (texture->pixFmt == EGL_PF_NV12)
+  {
+    /* both planes are read as a single plane of byte rows, damage is not
+     * tracked for the subsampled chroma plane */
+    framebuffer_read(
+      frame,
+      buf->map,
+      texture->stride,
+      texture->height + (texture->height + 1) / 2,
+      texture->stride,
+      1,
+      texture->stride
+    );
+
+    buf->damageRectsCount = 0;
+    texture->fullUpdate   = false;
+  }
+  else if (texture->fullUpdate || damageRectsCount <= 0 ||
+      damageRectsCount > KVMFR_MAX_DAMAGE_RECTS)
+  {
+    framebuffer_read(
+      frame,
+      buf->map,
+      texture->stride,
+      texture->height,
+      texture->width,
+      texture->bpp,
+      texture->stride
+    );
+
+    buf->damageRectsCount = 0;
+    texture->fullUpdate   = false;
+  }
+  else
+  {
+    framebuffer_read_rects(
+      frame,
+      buf->map,
+      texture->stride,
+      texture->height,
+      texture->width,
+      texture->bpp,
+      texture->stride,
+      damageRects,
+      damageRectsCount
+    );
+
+    buf->damageRectsCount = damageRectsCount;
+    memcpy(buf->damageRects, damageRects,
+        damageRectsCount * sizeof(FrameDamageRect));
+  }
 
   atomic_fetch_add_explicit(&texture->state.w, 1, memory_order_release);
 
@@ -507,8 +611,40 @@ enum EGL_TexStatus egl_texture_process(EGL_Texture * texture)
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, texture->buf[b].pbo);
     glBindTexture(GL_TEXTURE_2D, texture->tex);
     glPixelStorei(GL_UNPACK_ROW_LENGTH, texture->pitch);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture->width, texture->height,
-        texture->format, texture->dataType, (const void *)0);
+
+    const struct Buffer * buf = &texture->buf[b];
+    if (buf->damageRectsCount == 0)
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture->width, texture->height,
+          texture->format, texture->dataType, (const void *)0);
+    else
+    {
+      /* only upload the areas that changed */
+      for(unsigned int i = 0; i < buf->damageRectsCount; ++i)
+      {
+        const FrameDamageRect * rect = buf->damageRects + i;
+        if (rect->x >= texture->width || rect->y >= texture->height)
+          continue;
+
+        const size_t w = rect->x + rect->width  > texture->width ?
+          texture->width  - rect->x : rect->width;
+        const size_t h = rect->y + rect->height > texture->height ?
+          texture->height - rect->y : rect->height;
+
+        glTexSubImage2D(GL_TEXTURE_2D, 0, rect->x, rect->y, w, h,
+            texture->format, texture->dataType,
+            (const void *)(rect->y * texture->stride + rect->x * texture->bpp));
+      }
+    }
+
+    if (texture->texUV)
+    {
+      glBindTexture(GL_TEXTURE_2D, texture->texUV);
+      glPixelStorei(GL_UNPACK_ROW_LENGTH, texture->stride / 2);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
+          (texture->width + 1) / 2, (texture->height + 1) / 2,
+          GL_RG, GL_UNSIGNED_BYTE,
+          (const void *)(texture->height * texture->stride));
+    }
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
     /* create a fence to prevent usage before the update is complete */
@@ -574,10 +710,18 @@ enum EGL_TexStatus egl_texture_bind(EGL_Texture * texture)
   glBindTexture(GL_TEXTURE_2D, texture->tex);
   glBindSampler(0, texture->sampler);
 
+  if (texture->texUV)
+  {
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, texture->texUV);
+    glBindSampler(1, texture->sampler);
+    glActiveTexture(GL_TEXTURE0);
+  }
+
   return EGL_TEX_STATUS_OK;
 }
 
 int egl_texture_count(EGL_Texture * texture)
 {
-  return 1;
+  return texture->pixFmt == EGL_PF_NV12 ? 2 : 1;
 }
@@ -351,7 +351,8 @@ void opengl_on_resize(void * opaque, const int width, const int height, const do
 }
 
 bool opengl_on_mouse_shape(void * opaque, const LG_RendererCursor cursor,
-    const int width, const int height, const int pitch, const uint8_t * data)
+    const int width, const int height, const int pitch, const uint8_t * data,
+    const uint64_t id)
 {
   struct Inst * this = (struct Inst *)opaque;
   if (!this)
@@ -406,7 +407,8 @@ bool opengl_on_frame_format(void * opaque, const LG_RendererFormat format, bool
   return true;
 }
 
-bool opengl_on_frame(void * opaque, const FrameBuffer * frame, int dmaFd)
+bool opengl_on_frame(void * opaque, const FrameBuffer * frame, int dmaFd,
+    const FrameDamageRect * damageRects, int damageRectsCount)
 {
   struct Inst * this = (struct Inst *)opaque;
 
@@ -694,14 +696,18 @@ bool opengl_render(void * opaque, LG_RendererRotate rotate)
   return true;
 }
 
-void opengl_update_fps(void * opaque, const float avgUPS, const float avgFPS)
+void opengl_update_fps(void * opaque, const float avgUPS, const float avgFPS,
+    const float avgLatency, const uint64_t drops, const char * hostStats)
 {
   struct Inst * this = (struct Inst *)opaque;
   if (!this->showFPS)
     return;
 
-  char str[128];
-  snprintf(str, sizeof(str), "UPS: %8.4f, FPS: %8.4f", avgUPS, avgFPS);
+  char str[256];
+  snprintf(str, sizeof(str),
+      "UPS: %8.4f, FPS: %8.4f, Latency: %6.2f ms, Dropped: %" PRIu64 "%s%s",
+      avgUPS, avgFPS, avgLatency, drops,
+      hostStats ? "\n" : "", hostStats ? hostStats : "");
 
   LG_FontBitmap *textSurface = NULL;
   if (!(textSurface = this->font->render(this->fontObj, 0xffffff00, str)))
@@ -1339,19 +1345,40 @@ static bool draw_frame(struct Inst * this)
 
   const int bpp = this->format.bpp / 8;
   glPixelStorei(GL_UNPACK_ALIGNMENT , bpp);
-  glPixelStorei(GL_UNPACK_ROW_LENGTH, this->format.width);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, this->format.pitch / bpp);
 
   this->texPos = 0;
 
-  framebuffer_read_fn(
-    this->frame,
-    this->format.height,
-    this->format.width,
-    bpp,
-    this->format.pitch,
-    opengl_buffer_fn,
-    this
-  );
+  if (this->format.compression == FRAME_COMPRESSION_RLE)
+  {
+    // decode directly into the buffer
+    void * map = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, this->texSize,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (!map)
+      check_gl_error("glMapBufferRange");
+    else
+    {
+      framebuffer_read_rle(
+        this->frame,
+        map,
+        this->format.pitch,
+        this->format.height,
+        this->format.width,
+        bpp
+      );
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+  }
+  else
+    framebuffer_read_fn(
+      this->frame,
+      this->format.height,
+      this->format.width,
+      bpp,
+      this->format.pitch,
+      opengl_buffer_fn,
+      this
+    );
 
   // update the texture
   glTexSubImage2D(
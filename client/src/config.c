@@ -24,6 +24,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "common/option.h"
 #include "common/debug.h"
 #include "common/stringutils.h"
+#include "common/KVMFR.h"
 
 #include <sys/stat.h>
 #include <pwd.h>
@@ -43,6 +44,7 @@ static char *     optSizeToString    (struct Option * opt);
 static bool       optScancodeValidate(struct Option * opt, const char ** error);
 static char *     optScancodeToString(struct Option * opt);
 static bool       optRotateValidate  (struct Option * opt, const char ** error);
+static bool       optOutputValidate  (struct Option * opt, const char ** error);
 
 static void doLicense();
 
@@ -96,6 +98,14 @@ static struct Option options[] =
     .type          = OPTION_TYPE_BOOL,
     .value.x_bool  = true
   },
+  {
+    .module        = "app",
+    .name          = "output",
+    .description   = "The guest output (monitor) to display, run one client per output",
+    .type          = OPTION_TYPE_INT,
+    .validator     = optOutputValidate,
+    .value.x_int   = 0
+  },
 
   // window options
   {
@@ -507,6 +517,7 @@ bool config_load(int argc, char * argv[])
   g_params.cursorPollInterval = option_get_int   ("app"  , "cursorPollInterval");
   g_params.framePollInterval  = option_get_int   ("app"  , "framePollInterval" );
   g_params.allowDMA           = option_get_bool  ("app"  , "allowDMA"          );
+  g_params.output             = option_get_int   ("app"  , "output"            );
 
   g_params.windowTitle     = option_get_string("win", "title"          );
   g_params.autoResize      = option_get_bool  ("win", "autoResize"     );
@@ -762,3 +773,12 @@ static bool optRotateValidate(struct Option * opt, const char ** error)
   *error = "Rotation angle must be one of 0, 90, 180 or 270";
   return false;
 }
+
+static bool optOutputValidate(struct Option * opt, const char ** error)
+{
+  if (opt->value.x_int >= 0 && opt->value.x_int < KVMFR_MAX_OUTPUTS)
+    return true;
+
+  *error = "Output index out of range";
+  return false;
+}
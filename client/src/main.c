@@ -93,6 +93,64 @@ static void lgInit(void)
     g_state.ds->showPointer(true);
 }
 
+/* the host statistics at the last FPS update, the displayed figures are for
+ * the interval since then */
+static struct
+{
+  uint64_t count[KVMFR_STAT_MAX];
+  uint64_t total[KVMFR_STAT_MAX];
+  uint64_t copyBuckets[KVMFR_STATS_BUCKETS];
+}
+hostStatsLast;
+
+static const char * hostStatsString(char * buf, size_t size)
+{
+  KVMFRStats * stats = g_state.hostStats;
+  if (!stats)
+    return NULL;
+
+  float avg[KVMFR_STAT_MAX];
+  for(int i = 0; i < KVMFR_STAT_MAX; ++i)
+  {
+    const uint64_t count =
+      atomic_load_explicit(&stats->stages[i].count, memory_order_relaxed);
+    const uint64_t total =
+      atomic_load_explicit(&stats->stages[i].total, memory_order_relaxed);
+
+    // the host was restarted
+    if (count < hostStatsLast.count[i])
+    {
+      hostStatsLast.count[i] = 0;
+      hostStatsLast.total[i] = 0;
+    }
+
+    avg[i] = count > hostStatsLast.count[i] ?
+      ((float)(total - hostStatsLast.total[i]) /
+        (count - hostStatsLast.count[i])) / 1e3f : 0.0f;
+
+    hostStatsLast.count[i] = count;
+    hostStatsLast.total[i] = total;
+  }
+
+  uint64_t buckets[KVMFR_STATS_BUCKETS];
+  for(int i = 0; i < KVMFR_STATS_BUCKETS; ++i)
+  {
+    const uint64_t v = atomic_load_explicit(
+        &stats->stages[KVMFR_STAT_COPY].buckets[i], memory_order_relaxed);
+    buckets[i] = v >= hostStatsLast.copyBuckets[i] ?
+      v - hostStatsLast.copyBuckets[i] : v;
+    hostStatsLast.copyBuckets[i] = v;
+  }
+
+  snprintf(buf, size,
+      "Host capture: %6.2f ms, copy: %6.2f ms (p99 %6.2f), queue wait: %6.2f ms, latency: %6.2f ms",
+      avg[KVMFR_STAT_CAPTURE], avg[KVMFR_STAT_COPY],
+      kvmfr_stats_percentile(buckets, 0.99) / 1e3f,
+      avg[KVMFR_STAT_QUEUE_WAIT], avg[KVMFR_STAT_LATENCY]);
+
+  return buf;
+}
+
 static int renderThread(void * unused)
 {
   if (!g_state.lgr->render_startup(g_state.lgrData))
@@ -135,6 +193,15 @@ static int renderThread(void * unused)
 
     if (g_state.showFPS)
     {
+      const uint64_t captureTime = atomic_exchange_explicit(
+          &g_state.frameCaptureTime, 0, memory_order_acquire);
+      const uint64_t now = microtime();
+      if (captureTime && now > captureTime)
+      {
+        g_state.latencyTime += now - captureTime;
+        ++g_state.latencyCount;
+      }
+
       const uint64_t t    = nanotime();
       g_state.renderTime   += t - g_state.lastFrameTime;
       g_state.lastFrameTime = t;
@@ -150,10 +217,18 @@ static int renderThread(void * unused)
           g_state.renderCount) /
           1e6f);
 
-        g_state.lgr->update_fps(g_state.lgrData, avgUPS, avgFPS);
+        const float avgLatency = g_state.latencyCount ?
+          ((float)g_state.latencyTime / g_state.latencyCount) / 1e3f : 0.0f;
+
+        char hostStats[160];
+        g_state.lgr->update_fps(g_state.lgrData, avgUPS, avgFPS, avgLatency,
+            atomic_load_explicit(&g_state.frameDrops, memory_order_relaxed),
+            hostStatsString(hostStats, sizeof(hostStats)));
 
-        g_state.renderTime  = 0;
-        g_state.renderCount = 0;
+        g_state.renderTime   = 0;
+        g_state.renderCount  = 0;
+        g_state.latencyTime  = 0;
+        g_state.latencyCount = 0;
       }
     }
 
@@ -211,44 +286,85 @@ static int cursorThread(void * unused)
     break;
   }
 
+  uint32_t posSeq = 0;
   while(g_state.state == APP_STATE_RUNNING)
   {
-    LGMPMessage msg;
-    if ((status = lgmpClientProcess(queue, &msg)) != LGMP_OK)
+    /* the latest position is read from the slot, the queue only carries the
+     * shape updates */
+    uint32_t output;
+    int16_t  x, y;
+    uint32_t flags;
+    const bool posUpdate = kvmfr_cursor_pos_read(g_state.cursorPos, &posSeq,
+        &output, &x, &y, &flags);
+
+    if (posUpdate)
     {
-      if (status == LGMP_ERR_QUEUE_EMPTY)
+      // the cursor is drawn by the client of the output it is on
+      const bool ours = output == g_params.output;
+      g_cursor.guest.visible = ours && (flags & CURSOR_FLAG_VISIBLE);
+      if (ours && (flags & CURSOR_FLAG_POSITION))
       {
-        if (g_cursor.redraw && g_cursor.guest.valid)
+        bool valid = g_cursor.guest.valid;
+        g_cursor.guest.x     = x;
+        g_cursor.guest.y     = y;
+        g_cursor.guest.valid = true;
+
+        // if the state just became valid
+        if (valid != true && core_inputEnabled())
         {
-          g_cursor.redraw = false;
-          g_state.lgr->on_mouse_event
-          (
-            g_state.lgrData,
-            g_cursor.guest.visible && (g_cursor.draw || !g_params.useSpiceInput),
-            g_cursor.guest.x,
-            g_cursor.guest.y
-          );
-
-          lgSignalEvent(e_frame);
+          core_alignToGuest();
+          app_resyncMouseBasic();
         }
 
-        const struct timespec req =
-        {
-          .tv_sec  = 0,
-          .tv_nsec = g_params.cursorPollInterval * 1000L
-        };
+        // tell the DS there was an update
+        core_handleGuestMouseUpdate();
+      }
+    }
 
-        struct timespec rem;
-        while(nanosleep(&req, &rem) < 0)
-          if (errno != -EINTR)
-          {
-            DEBUG_ERROR("nanosleep failed");
-            break;
-          }
+    LGMPMessage msg;
+    if ((status = lgmpClientProcess(queue, &msg)) == LGMP_OK)
+    {
+      KVMFRCursor * cursor = (KVMFRCursor *)msg.mem;
+      if (msg.udata & CURSOR_FLAG_SHAPE)
+      {
+        switch(cursor->type)
+        {
+          case CURSOR_TYPE_COLOR       : cursorType = LG_CURSOR_COLOR       ; break;
+          case CURSOR_TYPE_MONOCHROME  : cursorType = LG_CURSOR_MONOCHROME  ; break;
+          case CURSOR_TYPE_MASKED_COLOR: cursorType = LG_CURSOR_MASKED_COLOR; break;
+          default:
+            DEBUG_ERROR("Invalid cursor type");
+            lgmpClientMessageDone(queue);
+            continue;
+        }
 
-        continue;
+        g_cursor.guest.hx = cursor->hx;
+        g_cursor.guest.hy = cursor->hy;
+
+        // shapes the renderer has already seen do not need to be copied
+        const uint8_t * data = (const uint8_t *)(cursor + 1);
+        if (!(g_state.lgr->on_mouse_shape_id &&
+              g_state.lgr->on_mouse_shape_id(g_state.lgrData, cursor->id)) &&
+            !g_state.lgr->on_mouse_shape(
+              g_state.lgrData,
+              cursorType,
+              cursor->width,
+              cursor->height,
+              cursor->pitch,
+              data,
+              cursor->id)
+        )
+        {
+          DEBUG_ERROR("Failed to update mouse shape");
+          lgmpClientMessageDone(queue);
+          continue;
+        }
       }
 
+      lgmpClientMessageDone(queue);
+    }
+    else if (status != LGMP_ERR_QUEUE_EMPTY)
+    {
       if (status == LGMP_ERR_INVALID_SESSION)
         g_state.state = APP_STATE_RESTART;
       else
@@ -258,63 +374,39 @@ static int cursorThread(void * unused)
       }
       break;
     }
-
-    KVMFRCursor * cursor = (KVMFRCursor *)msg.mem;
-
-    g_cursor.guest.visible =
-      msg.udata & CURSOR_FLAG_VISIBLE;
-
-    if (msg.udata & CURSOR_FLAG_SHAPE)
+    else if (!posUpdate)
     {
-      switch(cursor->type)
+      if (g_cursor.redraw && g_cursor.guest.valid)
       {
-        case CURSOR_TYPE_COLOR       : cursorType = LG_CURSOR_COLOR       ; break;
-        case CURSOR_TYPE_MONOCHROME  : cursorType = LG_CURSOR_MONOCHROME  ; break;
-        case CURSOR_TYPE_MASKED_COLOR: cursorType = LG_CURSOR_MASKED_COLOR; break;
-        default:
-          DEBUG_ERROR("Invalid cursor type");
-          lgmpClientMessageDone(queue);
-          continue;
-      }
+        g_cursor.redraw = false;
+        g_state.lgr->on_mouse_event
+        (
+          g_state.lgrData,
+          g_cursor.guest.visible && (g_cursor.draw || !g_params.useSpiceInput),
+          g_cursor.guest.x,
+          g_cursor.guest.y
+        );
 
-      g_cursor.guest.hx = cursor->hx;
-      g_cursor.guest.hy = cursor->hy;
-
-      const uint8_t * data = (const uint8_t *)(cursor + 1);
-      if (!g_state.lgr->on_mouse_shape(
-        g_state.lgrData,
-        cursorType,
-        cursor->width,
-        cursor->height,
-        cursor->pitch,
-        data)
-      )
-      {
-        DEBUG_ERROR("Failed to update mouse shape");
-        lgmpClientMessageDone(queue);
-        continue;
+        lgSignalEvent(e_frame);
       }
-    }
-
-    if (msg.udata & CURSOR_FLAG_POSITION)
-    {
-      bool valid = g_cursor.guest.valid;
-      g_cursor.guest.x     = cursor->x;
-      g_cursor.guest.y     = cursor->y;
-      g_cursor.guest.valid = true;
 
-      // if the state just became valid
-      if (valid != true && core_inputEnabled())
+      const struct timespec req =
       {
-        core_alignToGuest();
-        app_resyncMouseBasic();
-      }
+        .tv_sec  = 0,
+        .tv_nsec = g_params.cursorPollInterval * 1000L
+      };
 
-      // tell the DS there was an update
-      core_handleGuestMouseUpdate();
+      struct timespec rem;
+      while(nanosleep(&req, &rem) < 0)
+        if (errno != -EINTR)
+        {
+          DEBUG_ERROR("nanosleep failed");
+          break;
+        }
+
+      continue;
     }
 
-    lgmpClientMessageDone(queue);
     g_cursor.redraw = false;
 
     g_state.lgr->on_mouse_event
@@ -347,9 +439,17 @@ int main_frameThread(void * unused)
 
   uint32_t          formatVer = 0;
   size_t            dataSize  = 0;
+  bool              frameDMA  = false;
   LG_RendererFormat lgrFormat;
 
   struct DMAFrameInfo dmaInfo[LGMP_Q_FRAME_LEN] = {0};
+
+  uint32_t lastSerial     = 0;
+  bool     serialValid    = false;
+  int64_t  clockOffset    = 0;
+  int64_t  clockWindowMin = INT64_MAX;
+  uint64_t clockWindow    = 0;
+
   const bool useDMA =
     g_params.allowDMA &&
     ivshmemHasDMA(&g_state.shm) &&
@@ -366,7 +466,8 @@ int main_frameThread(void * unused)
   // subscribe to the frame queue
   while(g_state.state == APP_STATE_RUNNING)
   {
-    status = lgmpClientSubscribe(g_state.lgmp, LGMP_Q_FRAME, &queue);
+    status = lgmpClientSubscribe(g_state.lgmp,
+        LGMP_Q_FRAME + g_params.output, &queue);
     if (status == LGMP_OK)
       break;
 
@@ -418,14 +519,44 @@ int main_frameThread(void * unused)
     KVMFRFrame * frame = (KVMFRFrame *)msg.mem;
     struct DMAFrameInfo *dma = NULL;
 
+    /* repeated frames keep their serial, any gap is a frame we never saw */
+    const bool newFrame = !serialValid || frame->frameSerial != lastSerial;
+    if (newFrame)
+    {
+      if (serialValid && frame->frameSerial - lastSerial > 1)
+        atomic_fetch_add_explicit(&g_state.frameDrops,
+            frame->frameSerial - lastSerial - 1, memory_order_relaxed);
+      lastSerial  = frame->frameSerial;
+      serialValid = true;
+
+      /* the host clock is unrelated to ours, estimate the offset from the
+       * smallest post to receive delay as this is close to zero for shared
+       * memory. The estimate is restarted periodically to follow drift. */
+      const uint64_t now   = microtime();
+      const int64_t  delta = (int64_t)(now - frame->postTime);
+      if (delta < clockWindowMin)
+        clockWindowMin = delta;
+
+      if (delta < clockOffset || now - clockWindow > 10000000)
+      {
+        clockOffset = clockWindowMin;
+        if (now - clockWindow > 10000000)
+        {
+          clockWindowMin = INT64_MAX;
+          clockWindow    = now;
+        }
+      }
+    }
+
     if (!g_state.formatValid || frame->formatVer != formatVer)
     {
       // setup the renderer format with the frame format details
-      lgrFormat.type   = frame->type;
-      lgrFormat.width  = frame->width;
-      lgrFormat.height = frame->height;
-      lgrFormat.stride = frame->stride;
-      lgrFormat.pitch  = frame->pitch;
+      lgrFormat.type        = frame->type;
+      lgrFormat.compression = frame->compression;
+      lgrFormat.width       = frame->width;
+      lgrFormat.height      = frame->height;
+      lgrFormat.stride      = frame->stride;
+      lgrFormat.pitch       = frame->pitch;
 
       switch(frame->rotation)
       {
@@ -451,12 +582,38 @@ int main_frameThread(void * unused)
           lgrFormat.bpp  = 64;
           break;
 
+        case FRAME_TYPE_NV12:
+          // full resolution Y plane followed by the interleaved UV plane
+          dataSize       = lgrFormat.pitch *
+            (lgrFormat.height + (lgrFormat.height + 1) / 2);
+          lgrFormat.bpp  = 12;
+          break;
+
         default:
           DEBUG_ERROR("Unsupported frameType");
           error = true;
           break;
       }
 
+      switch(frame->compression)
+      {
+        case FRAME_COMPRESSION_NONE:
+          break;
+
+        case FRAME_COMPRESSION_RLE:
+          if (lgrFormat.bpp != 32)
+          {
+            DEBUG_ERROR("RLE compression is only supported for 32bpp frames");
+            error = true;
+          }
+          break;
+
+        default:
+          DEBUG_ERROR("Unsupported frame compression");
+          error = true;
+          break;
+      }
+
       if (error)
       {
         lgmpClientMessageDone(queue);
@@ -467,13 +624,27 @@ int main_frameThread(void * unused)
       g_state.formatValid = true;
       formatVer = frame->formatVer;
 
-      DEBUG_INFO("Format: %s %ux%u stride:%u pitch:%u rotation:%d",
+      /* the host moves the frames when the queue depth or frame size changes
+       * so any existing DMA buffers can not be reused */
+      for(int i = 0; i < sizeof(dmaInfo) / sizeof(struct DMAFrameInfo); ++i)
+      {
+        if (dmaInfo[i].frame && dmaInfo[i].fd >= 0)
+          close(dmaInfo[i].fd);
+        dmaInfo[i].frame = NULL;
+      }
+
+      // compressed and planar data can not be imported directly
+      frameDMA = useDMA && frame->compression == FRAME_COMPRESSION_NONE &&
+        frame->type != FRAME_TYPE_NV12;
+
+      DEBUG_INFO("Format: %s%s %ux%u stride:%u pitch:%u rotation:%d",
           FrameTypeStr[frame->type],
+          frame->compression == FRAME_COMPRESSION_RLE ? " (RLE)" : "",
           frame->width, frame->height,
           frame->stride, frame->pitch,
           frame->rotation);
 
-      if (!g_state.lgr->on_frame_format(g_state.lgrData, lgrFormat, useDMA))
+      if (!g_state.lgr->on_frame_format(g_state.lgrData, lgrFormat, frameDMA))
       {
         DEBUG_ERROR("renderer failed to configure format");
         g_state.state = APP_STATE_SHUTDOWN;
@@ -490,7 +661,7 @@ int main_frameThread(void * unused)
       core_updatePositionInfo();
     }
 
-    if (useDMA)
+    if (frameDMA)
     {
       /* find the existing dma buffer if it exists */
       for(int i = 0; i < sizeof(dmaInfo) / sizeof(struct DMAFrameInfo); ++i)
@@ -539,7 +710,8 @@ int main_frameThread(void * unused)
     }
 
     FrameBuffer * fb = (FrameBuffer *)(((uint8_t*)frame) + frame->offset);
-    if (!g_state.lgr->on_frame(g_state.lgrData, fb, useDMA ? dma->fd : -1))
+    if (!g_state.lgr->on_frame(g_state.lgrData, fb, frameDMA ? dma->fd : -1,
+          frame->damageRects, frame->damageRectsCount))
     {
       lgmpClientMessageDone(queue);
       DEBUG_ERROR("renderer on frame returned failure");
@@ -547,6 +719,14 @@ int main_frameThread(void * unused)
       break;
     }
 
+    if (newFrame)
+      atomic_store_explicit(&g_state.frameCaptureTime,
+          frame->captureTime + clockOffset, memory_order_release);
+
+    // when auto detecting the minimum frame rate follow the guest's display
+    if (g_params.fpsMin == -1 && frame->frameInterval)
+      atomic_store(&g_state.frameTime, frame->frameInterval * 1000ULL);
+
     if (g_params.autoScreensaver && g_state.autoIdleInhibitState != frame->blockScreensaver)
     {
       if (frame->blockScreensaver)
@@ -567,7 +747,7 @@ int main_frameThread(void * unused)
   if (useDMA)
   {
     for(int i = 0; i < sizeof(dmaInfo) / sizeof(struct DMAFrameInfo); ++i)
-      if (dmaInfo[i].fd >= 0)
+      if (dmaInfo[i].frame && dmaInfo[i].fd >= 0)
         close(dmaInfo[i].fd);
   }
 
@@ -921,6 +1101,32 @@ restart:
   }
 
   DEBUG_INFO("Host ready, reported version: %s", udata->hostver);
+  DEBUG_INFO("Host outputs: %u, displaying output %u", udata->outputs,
+      g_params.output);
+
+  if (g_params.output >= udata->outputs)
+  {
+    DEBUG_ERROR("The host only provides %u output(s), invalid output %u",
+        udata->outputs, g_params.output);
+    return -1;
+  }
+
+  if (udata->cursorPos > g_state.shm.size - sizeof(KVMFRCursorPos))
+  {
+    DEBUG_ERROR("Invalid cursor position offset: 0x%x", udata->cursorPos);
+    return -1;
+  }
+  g_state.cursorPos = (KVMFRCursorPos *)
+    ((uint8_t *)g_state.shm.mem + udata->cursorPos);
+
+  if (udata->stats > g_state.shm.size - sizeof(KVMFRStats))
+  {
+    DEBUG_ERROR("Invalid statistics offset: 0x%x", udata->stats);
+    return -1;
+  }
+  g_state.hostStats = (KVMFRStats *)
+    ((uint8_t *)g_state.shm.mem + udata->stats);
+
   DEBUG_INFO("Starting session");
 
   if (!lgCreateThread("cursorThread", cursorThread, NULL, &t_cursor))
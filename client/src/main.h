@@ -27,6 +27,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "common/thread.h"
 #include "common/types.h"
 #include "common/ivshmem.h"
+#include "common/KVMFR.h"
 
 #include "spice/spice.h"
 #include <lgmp/client.h>
@@ -83,6 +84,8 @@ struct AppState
   PLGMPClient          lgmp;
   PLGMPClientQueue     frameQueue;
   PLGMPClientQueue     pointerQueue;
+  KVMFRCursorPos     * cursorPos;
+  KVMFRStats         * hostStats;
 
   LGThread            * frameThread;
   bool                  formatValid;
@@ -91,6 +94,10 @@ struct AppState
   uint64_t              renderTime;
   atomic_uint_least64_t frameCount;
   uint64_t              renderCount;
+  atomic_uint_least64_t frameCaptureTime;
+  atomic_uint_least64_t frameDrops;
+  uint64_t              latencyTime;
+  uint64_t              latencyCount;
 
 
   uint64_t resizeTimeout;
@@ -142,6 +149,7 @@ struct AppParams
   unsigned int      cursorPollInterval;
   unsigned int      framePollInterval;
   bool              allowDMA;
+  unsigned int      output;
 
   bool              forceRenderer;
   unsigned int      forceRendererIndex;
@@ -24,17 +24,22 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include "types.h"
 
 #define KVMFR_MAGIC   "KVMFR---"
-#define KVMFR_VERSION 9
+#define KVMFR_VERSION 19
 
 #define LGMP_Q_POINTER     1
-#define LGMP_Q_FRAME       2
+#define LGMP_Q_FRAME       2 // the first output, output n uses LGMP_Q_FRAME + n
 
-#define LGMP_Q_FRAME_LEN   2
+#define LGMP_Q_FRAME_LEN   4 // the maximum depth, the host selects the actual depth
 #define LGMP_Q_POINTER_LEN 20
 
+#define KVMFR_MAX_DAMAGE_RECTS 64
+#define KVMFR_MAX_OUTPUTS      4
+#define KVMFR_STATS_BUCKETS    20
+
 enum
 {
   CURSOR_FLAG_POSITION = 0x1,
@@ -49,12 +54,63 @@ typedef struct KVMFR
   char     magic[8];
   uint32_t version;
   char     hostver[32];
+  uint32_t outputs;    // the number of outputs (frame queues) the host provides
+  uint32_t cursorPos;  // offset from the start of the shared memory to the KVMFRCursorPos
+  uint32_t stats;      // offset from the start of the shared memory to the KVMFRStats
 }
 KVMFR;
 
+/* the latest cursor position & visibility, overwritten by the host on every
+ * change so that movement never has to wait for room in the pointer queue,
+ * which only carries shape updates */
+typedef struct KVMFRCursorPos
+{
+  _Atomic(uint32_t) seq;    // odd while the host is writing
+  volatile uint32_t output; // the output the cursor is on
+  volatile int16_t  x, y;   // cursor x & y position relative to the output
+  volatile uint32_t flags;  // CURSOR_FLAG_POSITION & CURSOR_FLAG_VISIBLE
+}
+KVMFRCursorPos;
+
+typedef enum KVMFRStatStage
+{
+  KVMFR_STAT_CAPTURE,    // the capture interface capturing the frame
+  KVMFR_STAT_WAIT_FRAME, // waiting for the capture interface to provide it
+  KVMFR_STAT_COPY,       // writing the frame into the shared memory
+  KVMFR_STAT_QUEUE_WAIT, // waiting for room in a frame queue, only when full
+  KVMFR_STAT_LATENCY,    // from the capture until the frame is written
+  KVMFR_STAT_MAX
+}
+KVMFRStatStage;
+
+/* the time taken by a stage in microseconds, bucket 0 counts zero and bucket
+ * n counts 2^(n-1) up to 2^n - 1, the last bucket counts everything longer */
+typedef struct KVMFRStatHist
+{
+  _Atomic(uint64_t) count;
+  _Atomic(uint64_t) total;
+  _Atomic(uint64_t) max;
+  _Atomic(uint64_t) buckets[KVMFR_STATS_BUCKETS];
+}
+KVMFRStatHist;
+
+/* host performance counters, these only ever increase while the host is
+ * running so readers take the difference between two samples */
+typedef struct KVMFRStats
+{
+  _Atomic(uint64_t) framesPosted;
+  _Atomic(uint64_t) framesDuplicate; // not posted as they were unchanged
+  _Atomic(uint64_t) captureTimeouts; // nothing changed
+  _Atomic(uint64_t) pointerPositions;
+  _Atomic(uint64_t) pointerShapes;
+  _Atomic(uint64_t) pointerRetries;  // shape posts retried as the queue was full
+  KVMFRStatHist     stages[KVMFR_STAT_MAX];
+}
+KVMFRStats;
+
 typedef struct KVMFRCursor
 {
-  int16_t    x, y;        // cursor x & y position
+  uint64_t   id;          // content hash of the shape, never zero
   CursorType type;        // shape buffer data type
   int8_t     hx, hy;      // shape hotspot x & y
   uint32_t   width;       // width of the shape
@@ -70,12 +126,39 @@ typedef struct KVMFRFrame
   uint32_t      width;             // the width
   uint32_t      height;            // the height
   FrameRotation rotation;          // the frame rotation
-  uint32_t      stride;            // the row stride (zero if compressed data)
-  uint32_t      pitch;             // the row pitch  (stride in bytes or the compressed frame size)
+  FrameCompression compression;   // how the frame data is compressed
+  uint32_t      stride;            // the row stride (of the decoded frame if compressed)
+  uint32_t      pitch;             // the row pitch  (of the decoded frame if compressed)
   uint32_t      offset;            // offset from the start of this header to the FrameBuffer header
   uint32_t      mouseScalePercent; // movement scale factor of the mouse (relates to DPI of display, 100 = no scale)
   bool          blockScreensaver;  // whether the guest has requested to block screensavers
+  uint32_t      frameSerial;       // incremented for each new frame, repeated frames keep their serial
+  uint64_t      captureTime;       // host microtime when the capture of the frame completed
+  uint64_t      postTime;          // host microtime when the frame was posted
+  uint64_t      writeTime;         // host microtime when the frame data was written (zero until then)
+  uint32_t      frameInterval;     // microseconds between captures when paced to the guest display, zero if not
+  uint32_t      damageRectsCount;  // the number of damage rects (zero for the full frame)
+  FrameDamageRect damageRects[KVMFR_MAX_DAMAGE_RECTS];
 }
 KVMFRFrame;
 
+/* write a new position to the slot, there must only be a single writer */
+void kvmfr_cursor_pos_write(KVMFRCursorPos * pos, uint32_t output,
+    int16_t x, int16_t y, uint32_t flags);
+
+/* read the position from the slot if it has changed since `seq`, which is
+ * updated on success, returns false if there was no change or if the slot
+ * stayed mid update (ie, the guest is paused) */
+bool kvmfr_cursor_pos_read(KVMFRCursorPos * pos, uint32_t * seq,
+    uint32_t * output, int16_t * x, int16_t * y, uint32_t * flags);
+
+/* record the time taken by a stage, safe to call from any thread */
+void kvmfr_stats_add(KVMFRStatHist * hist, uint64_t us);
+
+/* the upper bound in microseconds of the bucket that the percentile p (0-1)
+ * falls into given the bucket counts of an interval, or the lower bound if it
+ * is the last bucket */
+uint64_t kvmfr_stats_percentile(const uint64_t buckets[KVMFR_STATS_BUCKETS],
+    double p);
+
 #endif
@@ -24,15 +24,56 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "types.h"
+
 typedef struct stFrameBuffer FrameBuffer;
 
 typedef bool (*FrameBufferReadFn)(void * opaque, const void * src, size_t size);
 
+typedef enum FrameBufferKernel
+{
+  FB_KERNEL_AUTO  ,
+  FB_KERNEL_MEMCPY,
+  FB_KERNEL_SSE41 ,
+  FB_KERNEL_ERMS  ,
+  FB_KERNEL_AVX2  ,
+  FB_KERNEL_AVX512,
+  FB_KERNEL_MAX
+}
+FrameBufferKernel;
+
 /**
  * The size of the FrameBuffer struct
  */
 extern const size_t FrameBufferStructSize;
 
+/**
+ * Select the copy kernel used to move data in and out of the FrameBuffer.
+ * FB_KERNEL_AUTO selects the fastest kernel supported by this CPU, which is
+ * also what is used if this is never called.
+ * Returns false if the kernel is not supported by this CPU.
+ */
+bool framebuffer_set_kernel(FrameBufferKernel kernel);
+
+/**
+ * Get the copy kernel currently in use
+ */
+FrameBufferKernel framebuffer_get_kernel(void);
+
+/**
+ * Get the name of the specified copy kernel
+ */
+const char * framebuffer_kernel_name(FrameBufferKernel kernel);
+
+/**
+ * Split framebuffer_write across count threads, including the caller, to
+ * make better use of the memory bandwidth for large frames. 1 (the default)
+ * stops the threads. Only one write uses the threads at a time, concurrent
+ * writes are copied by the calling thread. This must not be called while a
+ * write is in progress.
+ */
+bool framebuffer_set_write_threads(unsigned int count);
+
 /**
  * Wait for the framebuffer to fill to the specified size
  */
@@ -44,20 +85,91 @@ void framebuffer_wait(const FrameBuffer * frame, size_t size);
 bool framebuffer_read(const FrameBuffer * frame, void * dst, size_t dstpitch,
     size_t height, size_t width, size_t bpp, size_t pitch);
 
+/**
+ * Read only the damaged areas of the KVMFRFrame into the dst buffer, the rest
+ * of dst is left untouched. Rects that fall outside of the frame are clipped.
+ */
+bool framebuffer_read_rects(const FrameBuffer * frame, void * dst,
+    size_t dstpitch, size_t height, size_t width, size_t bpp, size_t pitch,
+    const FrameDamageRect * rects, unsigned int count);
+
+/**
+ * Read and decode a FRAME_COMPRESSION_RLE compressed KVMFRFrame into the dst
+ * buffer. Only 32bpp formats can be compressed so bpp must be 4.
+ */
+bool framebuffer_read_rle(const FrameBuffer * frame, void * dst,
+    size_t dstpitch, size_t height, size_t width, size_t bpp);
+
 /**
  * Read data from the KVMFRFrame using a callback
+ *
+ * The callback is given the frame in order as it becomes available, in runs
+ * of as many complete rows as the writer has published. Rows are `pitch`
+ * bytes apart and the padding between rows is included, except after the
+ * final row.
  */
 bool framebuffer_read_fn(const FrameBuffer * frame, size_t height, size_t width,
     size_t bpp, size_t pitch, FrameBufferReadFn fn, void * opaque);
 
+/**
+ * Get the data of a completely written framebuffer, this is for buffers in
+ * local memory that are processed in place
+ */
+const void * framebuffer_get_data(const FrameBuffer * frame);
+
 /**
  * Prepare the framebuffer for writing
  */
 void framebuffer_prepare(FrameBuffer * frame);
 
+/**
+ * Get the data of the framebuffer for the writer to place data in directly,
+ * the reader does not see it until framebuffer_set_write_ptr is called
+ */
+void * framebuffer_get_buffer(FrameBuffer * frame);
+
+/**
+ * Publish the first size bytes of data placed in the framebuffer directly
+ */
+void framebuffer_set_write_ptr(FrameBuffer * frame, size_t size);
+
 /**
  * Write data from the src buffer into the KVMFRFrame
  */
 bool framebuffer_write(FrameBuffer * frame, const void * src, size_t size);
 
+/**
+ * Write data from the src buffer into the KVMFRFrame and compute a hash of it
+ * during the copy, this is for detecting identical frames and is not
+ * cryptographic
+ */
+bool framebuffer_write_hash(FrameBuffer * frame, const void * src, size_t size,
+    uint64_t * hash);
+
+/**
+ * The worst case size of a 32bpp frame compressed by framebuffer_write_rle
+ */
+size_t framebuffer_rle_bound(size_t width, size_t height);
+
+/**
+ * Compress 32bpp data from the src buffer into the KVMFRFrame
+ *
+ * Runs of identical pixels are stored once, everything else is stored as is.
+ * The output is published a row at a time so the reader can start decoding
+ * before we are done, it never exceeds framebuffer_rle_bound.
+ */
+bool framebuffer_write_rle(FrameBuffer * frame, const void * src,
+    size_t height, size_t width, size_t pitch);
+
+/**
+ * Convert 32bpp BGRA (or RGBA if rgba is set) data from the src buffer into a
+ * BT.709 full range NV12 KVMFRFrame.
+ *
+ * The Y plane is written as height rows of dstpitch bytes, followed by the
+ * interleaved U,V plane of (height + 1) / 2 rows of dstpitch bytes. dstpitch
+ * must be at least the width rounded up to an even number.
+ */
+bool framebuffer_write_nv12(FrameBuffer * frame, const void * src,
+    size_t height, size_t width, size_t pitch, size_t dstpitch, bool rgba);
+
 #endif
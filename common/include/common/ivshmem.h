@@ -43,4 +43,7 @@ void ivshmemFree(struct IVSHMEM * dev);
 bool ivshmemHasDMA   (struct IVSHMEM * dev);
 int  ivshmemGetDMABuf(struct IVSHMEM * dev, uint64_t offset, uint64_t size);
 
+/* the file descriptor of the mapping, owned by the device */
+int  ivshmemGetFd    (struct IVSHMEM * dev);
+
 #endif
@@ -20,6 +20,8 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef _LG_TYPES_H_
 #define _LG_TYPES_H_
 
+#include <stdint.h>
+
 struct Point
 {
   int x, y;
@@ -47,10 +49,19 @@ typedef enum FrameType
   FRAME_TYPE_RGBA      , // RGBA interleaved: R,G,B,A 32bpp
   FRAME_TYPE_RGBA10    , // RGBA interleaved: R,G,B,A 10,10,10,2 bpp
   FRAME_TYPE_RGBA16F   , // RGBA interleaved: R,G,B,A 16,16,16,16 bpp float
+  FRAME_TYPE_NV12      , // 8bpp Y plane followed by a half size interleaved U,V plane
   FRAME_TYPE_MAX       , // sentinel value
 }
 FrameType;
 
+typedef enum FrameCompression
+{
+  FRAME_COMPRESSION_NONE, // raw rows, pitch bytes apart
+  FRAME_COMPRESSION_RLE , // 32bpp run-length encoded, see framebuffer_write_rle
+  FRAME_COMPRESSION_MAX , // sentinel value
+}
+FrameCompression;
+
 typedef enum FrameRotation
 {
   FRAME_ROT_0,
@@ -62,6 +73,15 @@ FrameRotation;
 
 extern const char * FrameTypeStr[FRAME_TYPE_MAX];
 
+typedef struct FrameDamageRect
+{
+  uint32_t x;
+  uint32_t y;
+  uint32_t width;
+  uint32_t height;
+}
+FrameDamageRect;
+
 typedef enum CursorType
 {
   CURSOR_TYPE_COLOR       ,
@@ -19,11 +19,99 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include "common/KVMFR.h"
 
+// a write takes nanoseconds, if it is still in progress the host has stopped
+#define CURSOR_POS_RETRIES 1000
+
 const char * FrameTypeStr[FRAME_TYPE_MAX] =
 {
   "FRAME_TYPE_INVALID",
   "FRAME_TYPE_BGRA",
   "FRAME_TYPE_RGBA",
   "FRAME_TYPE_RGBA10",
-  "FRAME_TYPE_RGBA16F"
+  "FRAME_TYPE_RGBA16F",
+  "FRAME_TYPE_NV12"
 };
+
+void kvmfr_cursor_pos_write(KVMFRCursorPos * pos, uint32_t output,
+    int16_t x, int16_t y, uint32_t flags)
+{
+  const uint32_t seq = atomic_load_explicit(&pos->seq, memory_order_relaxed);
+  atomic_store_explicit(&pos->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  pos->output = output;
+  pos->x      = x;
+  pos->y      = y;
+  pos->flags  = flags;
+
+  atomic_store_explicit(&pos->seq, seq + 2, memory_order_release);
+}
+
+bool kvmfr_cursor_pos_read(KVMFRCursorPos * pos, uint32_t * seq,
+    uint32_t * output, int16_t * x, int16_t * y, uint32_t * flags)
+{
+  for(int retry = 0; retry < CURSOR_POS_RETRIES; ++retry)
+  {
+    const uint32_t start =
+      atomic_load_explicit(&pos->seq, memory_order_acquire);
+
+    if (start == *seq)
+      return false;
+
+    // the host is mid update, it will be done shortly
+    if (start & 1)
+      continue;
+
+    const uint32_t routput = pos->output;
+    const int16_t  rx      = pos->x;
+    const int16_t  ry      = pos->y;
+    const uint32_t rflags  = pos->flags;
+
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&pos->seq, memory_order_relaxed) != start)
+      continue;
+
+    *seq    = start;
+    *output = routput;
+    *x      = rx;
+    *y      = ry;
+    *flags  = rflags;
+    return true;
+  }
+
+  return false;
+}
+
+void kvmfr_stats_add(KVMFRStatHist * hist, uint64_t us)
+{
+  unsigned int bucket = us ? 64 - __builtin_clzll(us) : 0;
+  if (bucket >= KVMFR_STATS_BUCKETS)
+    bucket = KVMFR_STATS_BUCKETS - 1;
+
+  atomic_fetch_add_explicit(&hist->count          , 1 , memory_order_relaxed);
+  atomic_fetch_add_explicit(&hist->total          , us, memory_order_relaxed);
+  atomic_fetch_add_explicit(&hist->buckets[bucket], 1 , memory_order_relaxed);
+
+  uint64_t max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+  while(us > max && !atomic_compare_exchange_weak_explicit(&hist->max, &max,
+        us, memory_order_relaxed, memory_order_relaxed));
+}
+
+uint64_t kvmfr_stats_percentile(const uint64_t buckets[KVMFR_STATS_BUCKETS],
+    double p)
+{
+  uint64_t count = 0;
+  for(int i = 0; i < KVMFR_STATS_BUCKETS; ++i)
+    count += buckets[i];
+
+  if (!count)
+    return 0;
+
+  const uint64_t target = (uint64_t)(p * (count - 1)) + 1;
+  uint64_t seen = 0;
+  for(int i = 0; i < KVMFR_STATS_BUCKETS - 1; ++i)
+    if ((seen += buckets[i]) >= target)
+      return i ? (1ULL << i) - 1 : 0;
+
+  return 1ULL << (KVMFR_STATS_BUCKETS - 2);
+}
@@ -19,16 +19,24 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include "common/framebuffer.h"
 #include "common/debug.h"
+#include "common/thread.h"
+#include "common/event.h"
 
 #include <string.h>
 #include <stdatomic.h>
-#include <emmintrin.h>
-#include <smmintrin.h>
+#include <immintrin.h>
+#include <cpuid.h>
 #include <unistd.h>
 
 #define FB_CHUNK_SIZE 1048576 // 1MB
 #define FB_SPIN_LIMIT 10000   // 10ms
 
+// smaller writes are not worth waking the write threads for
+#define FB_POOL_MIN_SIZE (FB_CHUNK_SIZE * 4)
+
+#define FB_RLE_RUN     0x80000000u // the token is a run of a single pixel
+#define FB_RLE_MIN_RUN 4           // shorter runs are stored as literals
+
 struct stFrameBuffer
 {
   atomic_uint_least32_t wp;
@@ -37,6 +45,364 @@ struct stFrameBuffer
 
 const size_t FrameBufferStructSize = sizeof(FrameBuffer);
 
+typedef void (*FBCopyFn)(void * restrict dst, const void * restrict src,
+    size_t size);
+
+typedef void (*FBCopyRowsFn)(uint8_t * restrict dst, size_t dstpitch,
+    const uint8_t * restrict src, size_t pitch, size_t linewidth, size_t rows);
+
+static void fb_copyMemcpy(void * restrict dst, const void * restrict src,
+    size_t size)
+{
+  memcpy(dst, src, size);
+}
+
+static void fb_rowsMemcpy(uint8_t * restrict dst, size_t dstpitch,
+    const uint8_t * restrict src, size_t pitch, size_t linewidth, size_t rows)
+{
+  for(; rows; --rows, src += pitch, dst += dstpitch)
+    memcpy(dst, src, linewidth);
+}
+
+/**
+ * The SIMD kernels below use streaming loads which require an aligned source,
+ * any leading bytes are copied with memcpy to align the source first.
+ *
+ * Each also has a row kernel for copying between buffers with a different
+ * pitch. When the source rows are aligned and a whole number of blocks long,
+ * as they are for the 4 and 8 bpp formats at the common resolutions, the rows
+ * are copied without the per row alignment and tail handling.
+ */
+__attribute__((target("sse4.1")))
+static inline void fb_blocksSSE41(uint8_t * restrict d,
+    const uint8_t * restrict s, size_t blocks)
+{
+  for(; blocks; --blocks, s += 64, d += 64)
+  {
+    __m128i * _s = (__m128i *)s;
+    __m128i * _d = (__m128i *)d;
+    __m128i v1 = _mm_stream_load_si128(_s + 0);
+    __m128i v2 = _mm_stream_load_si128(_s + 1);
+    __m128i v3 = _mm_stream_load_si128(_s + 2);
+    __m128i v4 = _mm_stream_load_si128(_s + 3);
+
+    _mm_storeu_si128(_d + 0, v1);
+    _mm_storeu_si128(_d + 1, v2);
+    _mm_storeu_si128(_d + 2, v3);
+    _mm_storeu_si128(_d + 3, v4);
+  }
+}
+
+__attribute__((target("sse4.1")))
+static void fb_copySSE41(void * restrict dst, const void * restrict src,
+    size_t size)
+{
+  uint8_t       * restrict d = (uint8_t *)dst;
+  const uint8_t * restrict s = (const uint8_t *)src;
+
+  size_t head = -(uintptr_t)s & 0xF;
+  if (head > size)
+    head = size;
+
+  memcpy(d, s, head);
+  d    += head;
+  s    += head;
+  size -= head;
+
+  _mm_mfence();
+  fb_blocksSSE41(d, s, size / 64);
+
+  const size_t done = size & ~(size_t)63;
+  memcpy(d + done, s + done, size - done);
+}
+
+__attribute__((target("sse4.1")))
+static void fb_rowsSSE41(uint8_t * restrict dst, size_t dstpitch,
+    const uint8_t * restrict src, size_t pitch, size_t linewidth, size_t rows)
+{
+  if (((uintptr_t)src | pitch) & 0xF || linewidth & 0x3F)
+  {
+    for(; rows; --rows, src += pitch, dst += dstpitch)
+      fb_copySSE41(dst, src, linewidth);
+    return;
+  }
+
+  _mm_mfence();
+  for(; rows; --rows, src += pitch, dst += dstpitch)
+    fb_blocksSSE41(dst, src, linewidth / 64);
+}
+
+__attribute__((target("avx2")))
+static inline void fb_blocksAVX2(uint8_t * restrict d,
+    const uint8_t * restrict s, size_t blocks)
+{
+  for(; blocks; --blocks, s += 128, d += 128)
+  {
+    __m256i * _s = (__m256i *)s;
+    __m256i * _d = (__m256i *)d;
+    __m256i v1 = _mm256_stream_load_si256(_s + 0);
+    __m256i v2 = _mm256_stream_load_si256(_s + 1);
+    __m256i v3 = _mm256_stream_load_si256(_s + 2);
+    __m256i v4 = _mm256_stream_load_si256(_s + 3);
+
+    _mm256_storeu_si256(_d + 0, v1);
+    _mm256_storeu_si256(_d + 1, v2);
+    _mm256_storeu_si256(_d + 2, v3);
+    _mm256_storeu_si256(_d + 3, v4);
+  }
+}
+
+__attribute__((target("avx2")))
+static void fb_copyAVX2(void * restrict dst, const void * restrict src,
+    size_t size)
+{
+  uint8_t       * restrict d = (uint8_t *)dst;
+  const uint8_t * restrict s = (const uint8_t *)src;
+
+  size_t head = -(uintptr_t)s & 0x1F;
+  if (head > size)
+    head = size;
+
+  memcpy(d, s, head);
+  d    += head;
+  s    += head;
+  size -= head;
+
+  _mm_mfence();
+  fb_blocksAVX2(d, s, size / 128);
+
+  const size_t done = size & ~(size_t)127;
+  memcpy(d + done, s + done, size - done);
+}
+
+__attribute__((target("avx2")))
+static void fb_rowsAVX2(uint8_t * restrict dst, size_t dstpitch,
+    const uint8_t * restrict src, size_t pitch, size_t linewidth, size_t rows)
+{
+  if (((uintptr_t)src | pitch) & 0x1F || linewidth & 0x7F)
+  {
+    for(; rows; --rows, src += pitch, dst += dstpitch)
+      fb_copyAVX2(dst, src, linewidth);
+    return;
+  }
+
+  _mm_mfence();
+  for(; rows; --rows, src += pitch, dst += dstpitch)
+    fb_blocksAVX2(dst, src, linewidth / 128);
+}
+
+__attribute__((target("avx512f")))
+static inline void fb_blocksAVX512(uint8_t * restrict d,
+    const uint8_t * restrict s, size_t blocks)
+{
+  for(; blocks; --blocks, s += 256, d += 256)
+  {
+    __m512i * _s = (__m512i *)s;
+    __m512i * _d = (__m512i *)d;
+    __m512i v1 = _mm512_stream_load_si512(_s + 0);
+    __m512i v2 = _mm512_stream_load_si512(_s + 1);
+    __m512i v3 = _mm512_stream_load_si512(_s + 2);
+    __m512i v4 = _mm512_stream_load_si512(_s + 3);
+
+    _mm512_storeu_si512(_d + 0, v1);
+    _mm512_storeu_si512(_d + 1, v2);
+    _mm512_storeu_si512(_d + 2, v3);
+    _mm512_storeu_si512(_d + 3, v4);
+  }
+}
+
+__attribute__((target("avx512f")))
+static void fb_copyAVX512(void * restrict dst, const void * restrict src,
+    size_t size)
+{
+  uint8_t       * restrict d = (uint8_t *)dst;
+  const uint8_t * restrict s = (const uint8_t *)src;
+
+  size_t head = -(uintptr_t)s & 0x3F;
+  if (head > size)
+    head = size;
+
+  memcpy(d, s, head);
+  d    += head;
+  s    += head;
+  size -= head;
+
+  _mm_mfence();
+  fb_blocksAVX512(d, s, size / 256);
+
+  const size_t done = size & ~(size_t)255;
+  memcpy(d + done, s + done, size - done);
+}
+
+__attribute__((target("avx512f")))
+static void fb_rowsAVX512(uint8_t * restrict dst, size_t dstpitch,
+    const uint8_t * restrict src, size_t pitch, size_t linewidth, size_t rows)
+{
+  if (((uintptr_t)src | pitch) & 0x3F || linewidth & 0xFF)
+  {
+    for(; rows; --rows, src += pitch, dst += dstpitch)
+      fb_copyAVX512(dst, src, linewidth);
+    return;
+  }
+
+  _mm_mfence();
+  for(; rows; --rows, src += pitch, dst += dstpitch)
+    fb_blocksAVX512(dst, src, linewidth / 256);
+}
+
+static void fb_copyERMS(void * restrict dst, const void * restrict src,
+    size_t size)
+{
+  asm volatile(
+    "rep movsb"
+    : "+D"(dst), "+S"(src), "+c"(size)
+    :
+    : "memory"
+  );
+}
+
+static void fb_rowsERMS(uint8_t * restrict dst, size_t dstpitch,
+    const uint8_t * restrict src, size_t pitch, size_t linewidth, size_t rows)
+{
+  for(; rows; --rows, src += pitch, dst += dstpitch)
+    fb_copyERMS(dst, src, linewidth);
+}
+
+static bool fb_hasERMS(void)
+{
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+    return false;
+
+  return ebx & (1 << 9);
+}
+
+static bool fb_supported(FrameBufferKernel kernel)
+{
+  __builtin_cpu_init();
+  switch(kernel)
+  {
+    case FB_KERNEL_MEMCPY: return true;
+    case FB_KERNEL_SSE41 : return __builtin_cpu_supports("sse4.1");
+    case FB_KERNEL_ERMS  : return fb_hasERMS();
+    case FB_KERNEL_AVX2  : return __builtin_cpu_supports("avx2");
+    case FB_KERNEL_AVX512: return __builtin_cpu_supports("avx512f");
+    default:
+      return false;
+  }
+}
+
+static const FBCopyFn fb_kernels[FB_KERNEL_MAX] =
+{
+  [FB_KERNEL_MEMCPY] = fb_copyMemcpy,
+  [FB_KERNEL_SSE41 ] = fb_copySSE41,
+  [FB_KERNEL_ERMS  ] = fb_copyERMS,
+  [FB_KERNEL_AVX2  ] = fb_copyAVX2,
+  [FB_KERNEL_AVX512] = fb_copyAVX512
+};
+
+static const FBCopyRowsFn fb_rowKernels[FB_KERNEL_MAX] =
+{
+  [FB_KERNEL_MEMCPY] = fb_rowsMemcpy,
+  [FB_KERNEL_SSE41 ] = fb_rowsSSE41,
+  [FB_KERNEL_ERMS  ] = fb_rowsERMS,
+  [FB_KERNEL_AVX2  ] = fb_rowsAVX2,
+  [FB_KERNEL_AVX512] = fb_rowsAVX512
+};
+
+static const char * fb_kernelNames[FB_KERNEL_MAX] =
+{
+  [FB_KERNEL_AUTO  ] = "auto",
+  [FB_KERNEL_MEMCPY] = "memcpy",
+  [FB_KERNEL_SSE41 ] = "sse4.1",
+  [FB_KERNEL_ERMS  ] = "erms",
+  [FB_KERNEL_AVX2  ] = "avx2",
+  [FB_KERNEL_AVX512] = "avx512"
+};
+
+static _Atomic(FrameBufferKernel) fb_kernel = FB_KERNEL_AUTO;
+
+bool framebuffer_set_kernel(FrameBufferKernel kernel)
+{
+  if (kernel == FB_KERNEL_AUTO)
+  {
+    /* in order of preference */
+    static const FrameBufferKernel order[] =
+    {
+      FB_KERNEL_AVX512,
+      FB_KERNEL_AVX2,
+      FB_KERNEL_ERMS,
+      FB_KERNEL_SSE41,
+      FB_KERNEL_MEMCPY
+    };
+
+    for(int i = 0; i < sizeof(order) / sizeof(*order); ++i)
+      if (fb_supported(order[i]))
+      {
+        kernel = order[i];
+        break;
+      }
+  }
+  else if (kernel >= FB_KERNEL_MAX || !fb_supported(kernel))
+    return false;
+
+  atomic_store_explicit(&fb_kernel, kernel, memory_order_relaxed);
+  DEBUG_INFO("Copy Kernel      : %s", fb_kernelNames[kernel]);
+  return true;
+}
+
+FrameBufferKernel framebuffer_get_kernel(void)
+{
+  FrameBufferKernel kernel =
+    atomic_load_explicit(&fb_kernel, memory_order_relaxed);
+
+  if (kernel == FB_KERNEL_AUTO)
+  {
+    framebuffer_set_kernel(FB_KERNEL_AUTO);
+    kernel = atomic_load_explicit(&fb_kernel, memory_order_relaxed);
+  }
+
+  return kernel;
+}
+
+const char * framebuffer_kernel_name(FrameBufferKernel kernel)
+{
+  if (kernel >= FB_KERNEL_MAX)
+    return "invalid";
+  return fb_kernelNames[kernel];
+}
+
+static inline FBCopyFn fb_getCopyFn(void)
+{
+  return fb_kernels[framebuffer_get_kernel()];
+}
+
+static inline FBCopyRowsFn fb_getCopyRowsFn(void)
+{
+  return fb_rowKernels[framebuffer_get_kernel()];
+}
+
+/**
+ * Spin until there are at least size bytes available past rp
+ */
+static inline bool fb_spinWait(const FrameBuffer * frame, uint_least32_t rp,
+    size_t size, uint_least32_t * wp)
+{
+  int spinCount = 0;
+
+  *wp = atomic_load_explicit(&frame->wp, memory_order_acquire);
+  while(*wp - rp < size)
+  {
+    if (++spinCount == FB_SPIN_LIMIT)
+      return false;
+
+    usleep(1);
+    *wp = atomic_load_explicit(&frame->wp, memory_order_acquire);
+  }
+
+  return true;
+}
+
 void framebuffer_wait(const FrameBuffer * frame, size_t size)
 {
   while(atomic_load_explicit(&frame->wp, memory_order_acquire) < size)
@@ -51,72 +417,84 @@ void framebuffer_wait(const FrameBuffer * frame, size_t size)
   }
 }
 
+/**
+ * Copy height rows of linewidth bytes starting at rp, in runs of as many
+ * complete rows as the writer has published
+ */
+static bool fb_readRows(const FrameBuffer * frame, uint8_t * restrict d,
+    size_t dstpitch, size_t rp, size_t pitch, size_t linewidth, size_t height)
+{
+  const FBCopyRowsFn copyRows = fb_getCopyRowsFn();
+  uint_least32_t wp;
+
+  while(height)
+  {
+    if (!fb_spinWait(frame, 0, rp + linewidth, &wp))
+      return false;
+
+    size_t rows = (wp - rp - linewidth) / pitch + 1;
+    if (rows > height)
+      rows = height;
+
+    copyRows(d, dstpitch, frame->data + rp, pitch, linewidth, rows);
+
+    rp     += rows * pitch;
+    d      += rows * dstpitch;
+    height -= rows;
+  }
+
+  return true;
+}
+
 bool framebuffer_read(const FrameBuffer * frame, void * restrict dst,
     size_t dstpitch, size_t height, size_t width, size_t bpp, size_t pitch)
 {
+  const FBCopyFn copy      = fb_getCopyFn();
   uint8_t * restrict d     = (uint8_t*)dst;
   uint_least32_t rp        = 0;
-  size_t         y         = 0;
+  uint_least32_t wp;
   const size_t   linewidth = width * bpp;
 
-  while(y < height)
+  /* if the source and destination are both tightly packed the frame is one
+   * contiguous block, copy whatever has been written so far in one go */
+  if (pitch == linewidth && dstpitch == linewidth)
   {
-    uint_least32_t wp;
-    int spinCount = 0;
-
-    /* spinlock */
-    wp = atomic_load_explicit(&frame->wp, memory_order_acquire);
-    while(wp - rp < linewidth)
+    const size_t size = height * linewidth;
+    while(rp < size)
     {
-      if (++spinCount == FB_SPIN_LIMIT)
+      if (!fb_spinWait(frame, rp, 1, &wp))
         return false;
 
-      usleep(1);
-      wp = atomic_load_explicit(&frame->wp, memory_order_acquire);
+      const size_t avail = (wp > size ? size : wp) - rp;
+      copy(d + rp, frame->data + rp, avail);
+      rp += avail;
     }
 
-    /* copy any unaligned bytes */
-    const uint8_t * src = frame->data + rp;
-    const size_t unaligned = (uintptr_t)src & 0xF;
-    if (unaligned)
-    {
-      memcpy(d, src, unaligned);
-      src += unaligned;
-      d   += unaligned;
-    }
+    return true;
+  }
 
-    const size_t blocks = (linewidth - unaligned) / 64;
-    const size_t left   = (linewidth - unaligned) % 64;
+  return fb_readRows(frame, d, dstpitch, 0, pitch, linewidth, height);
+}
 
-    _mm_mfence();
-    __m128i * restrict s = (__m128i *)src;
-    for(int i = 0; i < blocks; ++i)
-    {
-      __m128i *_d = (__m128i *)d;
-      __m128i *_s = (__m128i *)s;
-      __m128i v1 = _mm_stream_load_si128(_s + 0);
-      __m128i v2 = _mm_stream_load_si128(_s + 1);
-      __m128i v3 = _mm_stream_load_si128(_s + 2);
-      __m128i v4 = _mm_stream_load_si128(_s + 3);
-
-      _mm_storeu_si128(_d + 0, v1);
-      _mm_storeu_si128(_d + 1, v2);
-      _mm_storeu_si128(_d + 2, v3);
-      _mm_storeu_si128(_d + 3, v4);
-
-      d += 64;
-      s += 4;
-    }
+bool framebuffer_read_rects(const FrameBuffer * frame, void * restrict dst,
+    size_t dstpitch, size_t height, size_t width, size_t bpp, size_t pitch,
+    const FrameDamageRect * rects, unsigned int count)
+{
+  uint8_t * restrict d = (uint8_t*)dst;
 
-    if (left)
-    {
-      memcpy(d, s, left);
-      d += left;
-    }
+  for(unsigned int i = 0; i < count; ++i)
+  {
+    const FrameDamageRect * rect = rects + i;
+    if (rect->x >= width || rect->y >= height)
+      continue;
 
-    rp += pitch;
-    d  += dstpitch - linewidth;
-    ++y;
+    const size_t w = rect->x + rect->width  > width  ? width  - rect->x : rect->width;
+    const size_t h = rect->y + rect->height > height ? height - rect->y : rect->height;
+    const size_t x = rect->x * bpp;
+
+    if (!fb_readRows(frame, d + rect->y * dstpitch + x, dstpitch,
+          rect->y * pitch + x, pitch, w * bpp, h))
+      return false;
   }
 
   return true;
@@ -125,31 +503,97 @@ bool framebuffer_read(const FrameBuffer * frame, void * restrict dst,
 bool framebuffer_read_fn(const FrameBuffer * frame, size_t height, size_t width,
     size_t bpp, size_t pitch, FrameBufferReadFn fn, void * opaque)
 {
-  uint_least32_t rp        = 0;
-  size_t         y         = 0;
-  const size_t   linewidth = width * bpp;
+  if (!height)
+    return true;
 
-  while(y < height)
+  const size_t   size = (height - 1) * pitch + width * bpp;
+  uint_least32_t rp   = 0;
+  uint_least32_t wp;
+
+  while(rp < size)
   {
-    uint_least32_t wp;
-    int spinCount = 0;
+    // wait for at least one complete row
+    const size_t remaining = size - rp;
+    if (!fb_spinWait(frame, rp, remaining < pitch ? remaining : pitch, &wp))
+      return false;
+
+    // only hand over whole rows unless this completes the frame
+    size_t avail = (wp > size ? size : wp) - rp;
+    if (avail < remaining)
+      avail -= avail % pitch;
+
+    if (!fn(opaque, frame->data + rp, avail))
+      return false;
+
+    rp += avail;
+  }
+
+  return true;
+}
+
+static inline void fb_fill32(uint32_t * restrict d, uint32_t value,
+    size_t count)
+{
+  const __m128i v = _mm_set1_epi32(value);
+  for(; count > 3; count -= 4, d += 4)
+    _mm_storeu_si128((__m128i *)d, v);
+
+  while(count--)
+    *d++ = value;
+}
+
+/**
+ * The RLE stream is a sequence of 32bit tokens, each followed by either a
+ * single pixel value that is repeated count times (FB_RLE_RUN) or by count
+ * literal pixels. Tokens never span rows.
+ */
+bool framebuffer_read_rle(const FrameBuffer * frame, void * restrict dst,
+    size_t dstpitch, size_t height, size_t width, size_t bpp)
+{
+  if (bpp != 4)
+  {
+    DEBUG_ERROR("RLE is only supported for 32bpp frames");
+    return false;
+  }
+
+  const FBCopyFn copy  = fb_getCopyFn();
+  const size_t   bound = framebuffer_rle_bound(width, height);
+  uint8_t * restrict d = (uint8_t*)dst;
+  uint_least32_t rp    = 0;
+  uint_least32_t wp    = 0;
 
-    /* spinlock */
-    wp = atomic_load_explicit(&frame->wp, memory_order_acquire);
-    while(wp - rp < linewidth)
+  for(size_t y = 0; y < height; ++y, d += dstpitch)
+  {
+    uint32_t * row = (uint32_t *)d;
+    for(size_t x = 0; x < width;)
     {
-      if (++spinCount == FB_SPIN_LIMIT)
+      if (wp - rp < sizeof(uint32_t) &&
+          !fb_spinWait(frame, rp, sizeof(uint32_t), &wp))
         return false;
 
-      usleep(1);
-      wp = atomic_load_explicit(&frame->wp, memory_order_acquire);
-    }
+      const uint32_t token = *(const uint32_t *)(frame->data + rp);
+      const size_t   count = token & ~FB_RLE_RUN;
+      const size_t   size  = sizeof(uint32_t) *
+        ((token & FB_RLE_RUN) ? 2 : count + 1);
 
-    if (!fn(opaque, frame->data + rp, linewidth))
-      return false;
+      if (count == 0 || count > width - x || rp + size > bound)
+      {
+        DEBUG_ERROR("Corrupt RLE frame data");
+        return false;
+      }
 
-    rp += pitch;
-    ++y;
+      if (wp - rp < size && !fb_spinWait(frame, rp, size, &wp))
+        return false;
+
+      const uint8_t * src = frame->data + rp + sizeof(uint32_t);
+      if (token & FB_RLE_RUN)
+        fb_fill32(row + x, *(const uint32_t *)src, count);
+      else
+        copy(row + x, src, count * sizeof(uint32_t));
+
+      rp += size;
+      x  += count;
+    }
   }
 
   return true;
@@ -163,44 +607,589 @@ void framebuffer_prepare(FrameBuffer * frame)
   atomic_store_explicit(&frame->wp, 0, memory_order_release);
 }
 
+const void * framebuffer_get_data(const FrameBuffer * frame)
+{
+  return frame->data;
+}
+
+void * framebuffer_get_buffer(FrameBuffer * frame)
+{
+  return frame->data;
+}
+
+void framebuffer_set_write_ptr(FrameBuffer * frame, size_t size)
+{
+  atomic_store_explicit(&frame->wp, size, memory_order_release);
+}
+
+/**
+ * The write pool splits a write into FB_CHUNK_SIZE chunks which are claimed
+ * in order by the calling thread and the workers. Chunks complete out of
+ * order so wp is only advanced over the completed chunks at its position,
+ * whoever completes a chunk tries to advance it, the readers never see a gap.
+ */
+struct FBWriteJob
+{
+  FrameBuffer   * frame;
+  const uint8_t * src;
+  size_t          size;
+  unsigned int    chunks;
+  atomic_uint     next;    // the next chunk to claim
+  atomic_uint     pending; // workers that have not finished this job
+  atomic_bool   * done;
+};
+
+struct FBWritePool
+{
+  unsigned int      workers;
+  LGThread       ** threads;
+  LGEvent        ** start;
+  LGEvent         * finished;
+  atomic_bool       running;
+  atomic_flag       busy;
+  struct FBWriteJob job;
+  unsigned int      doneSize;
+};
+
+static struct FBWritePool fb_pool = { .busy = ATOMIC_FLAG_INIT };
+
+static void fb_poolPublish(struct FBWriteJob * job)
+{
+  uint_least32_t wp = atomic_load(&job->frame->wp);
+  while(wp < job->size && atomic_load(&job->done[wp / FB_CHUNK_SIZE]))
+  {
+    const size_t end = (size_t)wp + FB_CHUNK_SIZE;
+    const uint_least32_t next = end > job->size ? job->size : end;
+
+    // on failure wp is reloaded, someone else advanced it
+    atomic_compare_exchange_weak(&job->frame->wp, &wp, next);
+  }
+}
+
+static void fb_poolRun(struct FBWriteJob * job)
+{
+  const FBCopyFn copy = fb_getCopyFn();
+  for(;;)
+  {
+    const unsigned int chunk = atomic_fetch_add(&job->next, 1);
+    if (chunk >= job->chunks)
+      break;
+
+    const size_t offset = (size_t)chunk * FB_CHUNK_SIZE;
+    const size_t len    = job->size - offset > FB_CHUNK_SIZE ?
+      FB_CHUNK_SIZE : job->size - offset;
+
+    copy(job->frame->data + offset, job->src + offset, len);
+    atomic_store(&job->done[chunk], true);
+    fb_poolPublish(job);
+  }
+}
+
+static int fb_poolThread(void * opaque)
+{
+  const unsigned int index = (uintptr_t)opaque;
+  for(;;)
+  {
+    lgWaitEvent(fb_pool.start[index], TIMEOUT_INFINITE);
+    if (!atomic_load(&fb_pool.running))
+      break;
+
+    fb_poolRun(&fb_pool.job);
+    if (atomic_fetch_sub(&fb_pool.job.pending, 1) == 1)
+      lgSignalEvent(fb_pool.finished);
+  }
+
+  return 0;
+}
+
+static void fb_poolStop(void)
+{
+  atomic_store(&fb_pool.running, false);
+  for(unsigned int i = 0; i < fb_pool.workers; ++i)
+  {
+    if (!fb_pool.threads[i])
+      continue;
+
+    lgSignalEvent(fb_pool.start[i]);
+    lgJoinThread(fb_pool.threads[i], NULL);
+  }
+
+  for(unsigned int i = 0; i < fb_pool.workers; ++i)
+    if (fb_pool.start[i])
+      lgFreeEvent(fb_pool.start[i]);
+
+  if (fb_pool.finished)
+    lgFreeEvent(fb_pool.finished);
+
+  free(fb_pool.threads);
+  free(fb_pool.start);
+  free(fb_pool.job.done);
+
+  fb_pool.workers      = 0;
+  fb_pool.threads      = NULL;
+  fb_pool.start        = NULL;
+  fb_pool.finished     = NULL;
+  fb_pool.job.done     = NULL;
+  fb_pool.doneSize     = 0;
+}
+
+bool framebuffer_set_write_threads(unsigned int count)
+{
+  fb_poolStop();
+  if (count <= 1)
+    return true;
+
+  fb_pool.workers  = count - 1;
+  fb_pool.threads  = calloc(fb_pool.workers, sizeof(*fb_pool.threads));
+  fb_pool.start    = calloc(fb_pool.workers, sizeof(*fb_pool.start   ));
+  fb_pool.finished = lgCreateEvent(true, 0);
+  if (!fb_pool.threads || !fb_pool.start || !fb_pool.finished)
+  {
+    DEBUG_ERROR("Failed to allocate the write pool");
+    fb_poolStop();
+    return false;
+  }
+
+  atomic_store(&fb_pool.running, true);
+  for(unsigned int i = 0; i < fb_pool.workers; ++i)
+  {
+    if (!(fb_pool.start[i] = lgCreateEvent(true, 0)) ||
+        !lgCreateThread("FBWrite", fb_poolThread, (void *)(uintptr_t)i,
+          &fb_pool.threads[i]))
+    {
+      DEBUG_ERROR("Failed to create the write pool threads");
+      fb_poolStop();
+      return false;
+    }
+  }
+
+  DEBUG_INFO("Write Threads    : %u", count);
+  return true;
+}
+
+static bool fb_poolWrite(FrameBuffer * frame, const uint8_t * src, size_t size)
+{
+  // only one write can use the pool at a time, others copy on their own
+  if (atomic_flag_test_and_set(&fb_pool.busy))
+    return false;
+
+  struct FBWriteJob * job = &fb_pool.job;
+  const unsigned int chunks = (size + FB_CHUNK_SIZE - 1) / FB_CHUNK_SIZE;
+  if (chunks > fb_pool.doneSize)
+  {
+    atomic_bool * done = realloc(job->done, chunks * sizeof(*done));
+    if (!done)
+    {
+      atomic_flag_clear(&fb_pool.busy);
+      return false;
+    }
+    job->done        = done;
+    fb_pool.doneSize = chunks;
+  }
+
+  for(unsigned int i = 0; i < chunks; ++i)
+    atomic_init(&job->done[i], false);
+
+  job->frame  = frame;
+  job->src    = src;
+  job->size   = size;
+  job->chunks = chunks;
+  atomic_store(&job->next   , 0);
+  atomic_store(&job->pending, fb_pool.workers);
+  lgResetEvent(fb_pool.finished);
+
+  for(unsigned int i = 0; i < fb_pool.workers; ++i)
+    lgSignalEvent(fb_pool.start[i]);
+
+  fb_poolRun(job);
+
+  /* wait for the workers to leave the job so it can be reused, every chunk
+   * has been copied once they have */
+  while(atomic_load(&job->pending))
+    lgWaitEvent(fb_pool.finished, TIMEOUT_INFINITE);
+
+  fb_poolPublish(job);
+  atomic_flag_clear(&fb_pool.busy);
+  return true;
+}
+
 bool framebuffer_write(FrameBuffer * frame, const void * restrict src, size_t size)
 {
-  __m128i * restrict s = (__m128i *)src;
-  __m128i * restrict d = (__m128i *)frame->data;
-  size_t wp = 0;
+  if (fb_pool.workers && size >= FB_POOL_MIN_SIZE &&
+      fb_poolWrite(frame, src, size))
+    return true;
 
-  _mm_mfence();
+  const FBCopyFn copy  = fb_getCopyFn();
+  const uint8_t  * s   = (const uint8_t *)src;
+  size_t           wp  = 0;
 
-  /* copy in chunks */
-  while(size > 63)
+  /* copy in chunks so the reader can start before we are done */
+  while(size)
   {
-    __m128i *_d = (__m128i *)d;
-    __m128i *_s = (__m128i *)s;
-    __m128i v1 = _mm_stream_load_si128(_s + 0);
-    __m128i v2 = _mm_stream_load_si128(_s + 1);
-    __m128i v3 = _mm_stream_load_si128(_s + 2);
-    __m128i v4 = _mm_stream_load_si128(_s + 3);
+    const size_t len = size > FB_CHUNK_SIZE ? FB_CHUNK_SIZE : size;
+    copy(frame->data + wp, s + wp, len);
+
+    size -= len;
+    wp   += len;
+    atomic_store_explicit(&frame->wp, wp, memory_order_release);
+  }
+
+  return true;
+}
+
+/**
+ * The hash is four independent lanes so the loop is not limited by the
+ * latency of a single chain, each lane takes every fourth 64-bit word.
+ * It is only used to detect identical frames, it is not cryptographic.
+ */
+typedef void (*FBHashFn)(uint64_t lanes[4], const uint8_t * p, size_t size);
+
+__attribute__((target("sse4.2")))
+static void fb_hashCRC32C(uint64_t lanes[4], const uint8_t * p, size_t size)
+{
+  uint64_t l0 = lanes[0], l1 = lanes[1], l2 = lanes[2], l3 = lanes[3];
+  for(; size > 31; size -= 32, p += 32)
+  {
+    uint64_t v[4];
+    memcpy(v, p, sizeof(v));
+    l0 = _mm_crc32_u64(l0, v[0]);
+    l1 = _mm_crc32_u64(l1, v[1]);
+    l2 = _mm_crc32_u64(l2, v[2]);
+    l3 = _mm_crc32_u64(l3, v[3]);
+  }
 
-    _mm_store_si128(_d + 0, v1);
-    _mm_store_si128(_d + 1, v2);
-    _mm_store_si128(_d + 2, v3);
-    _mm_store_si128(_d + 3, v4);
+  for(; size; --size, ++p)
+    l0 = _mm_crc32_u8(l0, *p);
 
-    s    += 4;
-    d    += 4;
-    size -= 64;
-    wp   += 64;
+  lanes[0] = l0; lanes[1] = l1; lanes[2] = l2; lanes[3] = l3;
+}
+
+static inline uint64_t fb_hashMix(uint64_t l, uint64_t v)
+{
+  l = (l ^ v) * 0x9E3779B97F4A7C15ull;
+  return l ^ (l >> 29);
+}
 
-    if (wp % FB_CHUNK_SIZE == 0)
-      atomic_store_explicit(&frame->wp, wp, memory_order_release);
+static void fb_hashScalar(uint64_t lanes[4], const uint8_t * p, size_t size)
+{
+  uint64_t l0 = lanes[0], l1 = lanes[1], l2 = lanes[2], l3 = lanes[3];
+  for(; size > 31; size -= 32, p += 32)
+  {
+    uint64_t v[4];
+    memcpy(v, p, sizeof(v));
+    l0 = fb_hashMix(l0, v[0]);
+    l1 = fb_hashMix(l1, v[1]);
+    l2 = fb_hashMix(l2, v[2]);
+    l3 = fb_hashMix(l3, v[3]);
   }
 
-  if(size)
+  for(; size; --size, ++p)
+    l0 = fb_hashMix(l0, *p);
+
+  lanes[0] = l0; lanes[1] = l1; lanes[2] = l2; lanes[3] = l3;
+}
+
+static FBHashFn fb_getHashFn(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.2") ? fb_hashCRC32C : fb_hashScalar;
+}
+
+bool framebuffer_write_hash(FrameBuffer * frame, const void * restrict src,
+    size_t size, uint64_t * hash)
+{
+  const FBCopyFn   copy = fb_getCopyFn();
+  const FBHashFn   hfn  = fb_getHashFn();
+  const uint8_t  * s    = (const uint8_t *)src;
+  size_t           wp   = 0;
+  uint64_t lanes[4] =
   {
-    memcpy(frame->data + wp, s, size);
-    wp += size;
+    0xFFFFFFFF, 0x243F6A88, 0x85A308D3, 0x13198A2E
+  };
+
+  /* hash each chunk from the destination while it is still in the cache,
+   * every chunk but the last is a multiple of the lane stride */
+  while(size)
+  {
+    const size_t len = size > FB_CHUNK_SIZE ? FB_CHUNK_SIZE : size;
+    copy(frame->data + wp, s + wp, len);
+    hfn(lanes, frame->data + wp, len);
+
+    size -= len;
+    wp   += len;
+    atomic_store_explicit(&frame->wp, wp, memory_order_release);
+  }
+
+  *hash = ((lanes[0] << 32 | (uint32_t)lanes[1]) * 0xC2B2AE3D27D4EB4Full) ^
+           (lanes[2] << 32 | (uint32_t)lanes[3]) ^ wp;
+  return true;
+}
+
+size_t framebuffer_rle_bound(size_t width, size_t height)
+{
+  /* a literal costs one token more than the raw pixels and a run at least one
+   * token less, so only the literal that ends each row can grow the data */
+  return height * (width + 1) * sizeof(uint32_t);
+}
+
+/**
+ * Count how many pixels from the start of p have the same value
+ */
+static inline size_t fb_runLength(const uint32_t * p, size_t count)
+{
+  if (count < 2 || p[1] != p[0])
+    return 1;
+
+  const __m128i v = _mm_set1_epi32(p[0]);
+  size_t i = 2;
+  for(; i + 4 <= count; i += 4)
+  {
+    const int mask = _mm_movemask_epi8(_mm_cmpeq_epi32(
+          _mm_loadu_si128((const __m128i *)(p + i)), v));
+
+    if (mask != 0xFFFF)
+      return i + (__builtin_ctz(~mask) >> 2);
+  }
+
+  while(i < count && p[i] == p[0])
+    ++i;
+
+  return i;
+}
+
+static inline size_t fb_writeLiteral(uint8_t * d, size_t wp,
+    const uint32_t * src, size_t count, FBCopyFn copy)
+{
+  if (!count)
+    return wp;
+
+  *(uint32_t *)(d + wp) = count;
+  wp += sizeof(uint32_t);
+
+  const size_t size = count * sizeof(uint32_t);
+  if (size < 256)
+    memcpy(d + wp, src, size);
+  else
+    copy(d + wp, src, size);
+
+  return wp + size;
+}
+
+bool framebuffer_write_rle(FrameBuffer * frame, const void * restrict src,
+    size_t height, size_t width, size_t pitch)
+{
+  const FBCopyFn  copy = fb_getCopyFn();
+  const uint8_t * s    = (const uint8_t *)src;
+  uint8_t       * d    = frame->data;
+  size_t          wp   = 0;
+
+  for(size_t y = 0; y < height; ++y, s += pitch)
+  {
+    const uint32_t * row = (const uint32_t *)s;
+    size_t lit = 0;
+
+    for(size_t x = 0; x < width;)
+    {
+      const size_t run = fb_runLength(row + x, width - x);
+      if (run < FB_RLE_MIN_RUN)
+      {
+        x += run;
+        continue;
+      }
+
+      wp = fb_writeLiteral(d, wp, row + lit, x - lit, copy);
+
+      uint32_t * token = (uint32_t *)(d + wp);
+      token[0] = FB_RLE_RUN | run;
+      token[1] = row[x];
+      wp += 2 * sizeof(uint32_t);
+
+      x  += run;
+      lit = x;
+    }
+
+    wp = fb_writeLiteral(d, wp, row + lit, width - lit, copy);
+
+    /* publish each row so the reader can start before we are done */
+    atomic_store_explicit(&frame->wp, wp, memory_order_release);
+  }
+
+  return true;
+}
+
+/**
+ * BT.709 full range coefficients for B, G & R scaled by 1 << FB_NV12_SHIFT
+ */
+#define FB_NV12_SHIFT 14
+
+static const int16_t fb_nv12Coef[3][3] =
+{
+  {  1183, 11718,  3483 }, // Y
+  {  8192, -6314, -1878 }, // U
+  {  -750, -7442,  8192 }  // V
+};
+
+static inline uint8_t fb_clamp8(int v)
+{
+  return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static inline int fb_nv12Dot(const uint8_t * p, const int16_t * c, bool rgba)
+{
+  const int b = rgba ? p[2] : p[0];
+  const int r = rgba ? p[0] : p[2];
+  return b * c[0] + p[1] * c[1] + r * c[2];
+}
+
+/**
+ * Convert a pair of rows from x to the end, y1 is NULL for the final row of a
+ * frame with an odd height in which case s1 must equal s0
+ */
+static void fb_nv12RowsScalar(uint8_t * y0, uint8_t * y1, uint8_t * uv,
+    const uint8_t * s0, const uint8_t * s1, size_t x, size_t width, bool rgba)
+{
+  for(; x < width; x += 2)
+  {
+    const size_t x1 = x + 1 < width ? x + 1 : x;
+
+    y0[x] = fb_clamp8((fb_nv12Dot(s0 + x * 4, fb_nv12Coef[0], rgba) +
+          (1 << (FB_NV12_SHIFT - 1))) >> FB_NV12_SHIFT);
+    if (y1)
+      y1[x] = fb_clamp8((fb_nv12Dot(s1 + x * 4, fb_nv12Coef[0], rgba) +
+            (1 << (FB_NV12_SHIFT - 1))) >> FB_NV12_SHIFT);
+
+    if (x1 != x)
+    {
+      y0[x1] = fb_clamp8((fb_nv12Dot(s0 + x1 * 4, fb_nv12Coef[0], rgba) +
+            (1 << (FB_NV12_SHIFT - 1))) >> FB_NV12_SHIFT);
+      if (y1)
+        y1[x1] = fb_clamp8((fb_nv12Dot(s1 + x1 * 4, fb_nv12Coef[0], rgba) +
+              (1 << (FB_NV12_SHIFT - 1))) >> FB_NV12_SHIFT);
+    }
+
+    // average vertically first, as the SIMD version does
+    uint8_t a0[3], a1[3];
+    for(int c = 0; c < 3; ++c)
+    {
+      a0[c] = (s0[x  * 4 + c] + s1[x  * 4 + c] + 1) >> 1;
+      a1[c] = (s0[x1 * 4 + c] + s1[x1 * 4 + c] + 1) >> 1;
+    }
+
+    const int u = (fb_nv12Dot(a0, fb_nv12Coef[1], rgba) +
+        fb_nv12Dot(a1, fb_nv12Coef[1], rgba) + (1 << FB_NV12_SHIFT)) >>
+      (FB_NV12_SHIFT + 1);
+    const int v = (fb_nv12Dot(a0, fb_nv12Coef[2], rgba) +
+        fb_nv12Dot(a1, fb_nv12Coef[2], rgba) + (1 << FB_NV12_SHIFT)) >>
+      (FB_NV12_SHIFT + 1);
+
+    uv[x    ] = fb_clamp8(u + 128);
+    uv[x + 1] = fb_clamp8(v + 128);
+  }
+}
+
+/**
+ * The dot product of each of the 4 pixels in px with the coefficients
+ */
+__attribute__((target("ssse3")))
+static inline __m128i fb_nv12Dot4(__m128i px, __m128i coef)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i lo   = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), coef);
+  const __m128i hi   = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), coef);
+  return _mm_hadd_epi32(lo, hi);
+}
+
+/**
+ * Convert a pair of rows 8 pixels at a time, returns how far it got
+ */
+__attribute__((target("ssse3")))
+static size_t fb_nv12RowsSSSE3(uint8_t * y0, uint8_t * y1, uint8_t * uv,
+    const uint8_t * s0, const uint8_t * s1, size_t width, bool rgba)
+{
+  __m128i coef[3];
+  for(int i = 0; i < 3; ++i)
+  {
+    const int16_t * c = fb_nv12Coef[i];
+    coef[i] = rgba ?
+      _mm_setr_epi16(c[2], c[1], c[0], 0, c[2], c[1], c[0], 0) :
+      _mm_setr_epi16(c[0], c[1], c[2], 0, c[0], c[1], c[2], 0);
+  }
+
+  const __m128i yRound  = _mm_set1_epi32(1 << (FB_NV12_SHIFT - 1));
+  const __m128i uvRound = _mm_set1_epi32(1 << FB_NV12_SHIFT);
+  const __m128i uvBias  = _mm_set1_epi16(128);
+
+  size_t x = 0;
+  for(; x + 8 <= width; x += 8)
+  {
+    const __m128i a0 = _mm_loadu_si128((const __m128i *)(s0 + x * 4));
+    const __m128i b0 = _mm_loadu_si128((const __m128i *)(s0 + x * 4 + 16));
+    const __m128i a1 = _mm_loadu_si128((const __m128i *)(s1 + x * 4));
+    const __m128i b1 = _mm_loadu_si128((const __m128i *)(s1 + x * 4 + 16));
+
+    __m128i ya = _mm_srai_epi32(_mm_add_epi32(fb_nv12Dot4(a0, coef[0]), yRound), FB_NV12_SHIFT);
+    __m128i yb = _mm_srai_epi32(_mm_add_epi32(fb_nv12Dot4(b0, coef[0]), yRound), FB_NV12_SHIFT);
+    _mm_storel_epi64((__m128i *)(y0 + x),
+        _mm_packus_epi16(_mm_packs_epi32(ya, yb), _mm_setzero_si128()));
+
+    if (y1)
+    {
+      ya = _mm_srai_epi32(_mm_add_epi32(fb_nv12Dot4(a1, coef[0]), yRound), FB_NV12_SHIFT);
+      yb = _mm_srai_epi32(_mm_add_epi32(fb_nv12Dot4(b1, coef[0]), yRound), FB_NV12_SHIFT);
+      _mm_storel_epi64((__m128i *)(y1 + x),
+          _mm_packus_epi16(_mm_packs_epi32(ya, yb), _mm_setzero_si128()));
+    }
+
+    // average vertically, then sum horizontal pairs
+    const __m128i va = _mm_avg_epu8(a0, a1);
+    const __m128i vb = _mm_avg_epu8(b0, b1);
+
+    __m128i u = _mm_hadd_epi32(fb_nv12Dot4(va, coef[1]), fb_nv12Dot4(vb, coef[1]));
+    __m128i v = _mm_hadd_epi32(fb_nv12Dot4(va, coef[2]), fb_nv12Dot4(vb, coef[2]));
+    u = _mm_srai_epi32(_mm_add_epi32(u, uvRound), FB_NV12_SHIFT + 1);
+    v = _mm_srai_epi32(_mm_add_epi32(v, uvRound), FB_NV12_SHIFT + 1);
+
+    const __m128i uv16 = _mm_add_epi16(_mm_unpacklo_epi16(
+          _mm_packs_epi32(u, u), _mm_packs_epi32(v, v)), uvBias);
+    _mm_storel_epi64((__m128i *)(uv + x), _mm_packus_epi16(uv16, uv16));
+  }
+
+  return x;
+}
+
+bool framebuffer_write_nv12(FrameBuffer * frame, const void * restrict src,
+    size_t height, size_t width, size_t pitch, size_t dstpitch, bool rgba)
+{
+  static int hasSSSE3 = -1;
+  if (hasSSSE3 < 0)
+  {
+    __builtin_cpu_init();
+    hasSSSE3 = __builtin_cpu_supports("ssse3");
+  }
+
+  const uint8_t * s     = (const uint8_t *)src;
+  uint8_t       * yp    = frame->data;
+  uint8_t       * uvp   = frame->data + height * dstpitch;
+
+  for(size_t y = 0; y < height; y += 2, uvp += dstpitch)
+  {
+    const uint8_t * s0 = s  + y * pitch;
+    const uint8_t * s1 = y + 1 < height ? s0 + pitch : s0;
+    uint8_t       * y0 = yp + y * dstpitch;
+    uint8_t       * y1 = y + 1 < height ? y0 + dstpitch : NULL;
+
+    size_t x = 0;
+    if (hasSSSE3)
+      x = fb_nv12RowsSSSE3(y0, y1, uvp, s0, s1, width, rgba);
+    fb_nv12RowsScalar(y0, y1, uvp, s0, s1, x, width, rgba);
+
+    /* the U,V plane is written alongside, it is published with the last row
+     * of the Y plane so that the reader can start on the Y plane early */
+    const size_t rows = y1 ? y + 2 : y + 1;
+    atomic_store_explicit(&frame->wp,
+        rows == height ? (height + (height + 1) / 2) * dstpitch :
+        rows * dstpitch, memory_order_release);
   }
 
-  atomic_store_explicit(&frame->wp, wp, memory_order_release);
   return true;
 }
@@ -215,6 +215,16 @@ bool ivshmemHasDMA(struct IVSHMEM * dev)
   return info->hasDMA;
 }
 
+int ivshmemGetFd(struct IVSHMEM * dev)
+{
+  assert(dev && dev->opaque);
+
+  struct IVSHMEMInfo * info =
+    (struct IVSHMEMInfo *)dev->opaque;
+
+  return info->devFd;
+}
+
 int ivshmemGetDMABuf(struct IVSHMEM * dev, uint64_t offset, uint64_t size)
 {
   assert(ivshmemHasDMA(dev));
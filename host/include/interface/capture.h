@@ -22,6 +22,8 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <stdbool.h>
 #include <stdint.h>
 #include "common/framebuffer.h"
+#include "common/ivshmem.h"
+#include "common/KVMFR.h"
 
 typedef enum CaptureResult
 {
@@ -67,12 +69,23 @@ typedef struct CaptureFrame
   unsigned int    stride;
   CaptureFormat   format;
   CaptureRotation rotation;
+
+  // the output this frame belongs to, less than getOutputCount
+  unsigned int    output;
+
+  // microseconds between captures if they are paced to the display, or zero
+  unsigned int    interval;
+
+  // the areas that changed since the last frame, zero for the full frame
+  unsigned int    damageRectsCount;
+  FrameDamageRect damageRects[KVMFR_MAX_DAMAGE_RECTS];
 }
 CaptureFrame;
 
 typedef struct CapturePointer
 {
   bool          positionUpdate;
+  unsigned int  output; // the output x & y are relative to
   int           x, y;
   bool          visible;
 
@@ -87,6 +100,10 @@ CapturePointer;
 typedef bool (*CaptureGetPointerBuffer )(void ** data, uint32_t * size);
 typedef void (*CapturePostPointerBuffer)(CapturePointer pointer);
 
+// writes the frame data, the capture interface must use this in getFrame
+typedef bool (*CaptureWriteFrame)(FrameBuffer * frame, const void * src,
+    size_t size);
+
 typedef struct CaptureInterface
 {
   const char     *shortName;
@@ -95,16 +112,27 @@ typedef struct CaptureInterface
 
   bool(*create)(
     CaptureGetPointerBuffer  getPointerBufferFn,
-    CapturePostPointerBuffer postPointerBufferFn
+    CapturePostPointerBuffer postPointerBufferFn,
+    CaptureWriteFrame        writeFrameFn
   );
 
+  /* optional, the shared memory the frames are written into, called before
+   * init and only if the frame data is written unmodified. The interface may
+   * then place the data of a FrameBuffer that lies within it directly with
+   * framebuffer_get_buffer and framebuffer_set_write_ptr instead of using
+   * CaptureWriteFrame */
+  void          (*setSharedMemory)(struct IVSHMEM * shm);
+
   bool          (*init           )();
   void          (*stop           )();
   bool          (*deinit         )();
   void          (*free           )();
-  unsigned int  (*getMaxFrameSize)();
+  unsigned int  (*getMaxFrameSize)(); // the largest frame of any output
   unsigned int  (*getMouseScale  )();
 
+  // optional, the number of outputs captured, NULL if only one
+  unsigned int  (*getOutputCount )();
+
   CaptureResult (*capture   )();
   CaptureResult (*waitFrame )(CaptureFrame * frame);
   CaptureResult (*getFrame  )(FrameBuffer  * frame);
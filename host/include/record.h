@@ -0,0 +1,39 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017-2019 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "interface/capture.h"
+
+/*
+ * Records the captured session to a file in the format of replay.h so it can
+ * be played back by the Replay capture interface. Only the first output is
+ * recorded. These are safe to call from the frame and pointer threads at the
+ * same time, and do nothing if the recording is not open.
+ */
+
+bool record_open(const char * path);
+void record_close(void);
+bool record_active(void);
+
+void record_frame(const CaptureFrame * frame, const void * data, size_t size);
+void record_cursor(const CapturePointer * pointer, const void * shape,
+    size_t shapeSize);
@@ -0,0 +1,98 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017-2019 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "common/types.h"
+#include "common/KVMFR.h"
+
+/*
+ * Recorded session file format, all values are little endian.
+ *
+ * The file starts with a ReplayHeader followed by a sequence of records.
+ * Each record starts on a REPLAY_ALIGN boundary with a ReplayRecord header
+ * followed by `size` bytes of payload. The frame pixel data is stored as
+ * captured so that it can be written to the shared memory directly from the
+ * mapping of the file.
+ *
+ * These files are written by the host with app:record (see record.h), which
+ * only records the first output.
+ */
+
+#define REPLAY_MAGIC   "LGREPLAY"
+#define REPLAY_VERSION 1
+#define REPLAY_ALIGN   64
+
+#define REPLAY_ALIGN_UP(x) \
+  (((x) + REPLAY_ALIGN - 1) & ~((size_t)REPLAY_ALIGN - 1))
+
+typedef struct ReplayHeader
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t reserved;
+}
+ReplayHeader;
+
+enum ReplayRecordType
+{
+  REPLAY_RECORD_FRAME  = 1,
+  REPLAY_RECORD_CURSOR = 2
+};
+
+typedef struct ReplayRecord
+{
+  uint32_t type;      // ReplayRecordType
+  uint32_t size;      // the size of the payload that follows this header
+  uint64_t timestamp; // microseconds since the start of the recording
+}
+ReplayRecord;
+
+// the payload of a REPLAY_RECORD_FRAME
+typedef struct ReplayFrame
+{
+  uint32_t        width;
+  uint32_t        height;
+  uint32_t        pitch;
+  uint32_t        stride;
+  uint32_t        format;     // CaptureFormat, one of the frame formats
+  uint32_t        dataOffset; // from the start of this payload, should be REPLAY_ALIGN aligned
+  uint32_t        damageRectsCount;
+  uint32_t        reserved;
+  FrameDamageRect damageRects[KVMFR_MAX_DAMAGE_RECTS];
+}
+ReplayFrame;
+
+#define REPLAY_CURSOR_FLAG_POSITION 0x1
+#define REPLAY_CURSOR_FLAG_VISIBLE  0x2
+#define REPLAY_CURSOR_FLAG_SHAPE    0x4
+
+// the payload of a REPLAY_RECORD_CURSOR, followed by the shape if present
+typedef struct ReplayCursor
+{
+  int32_t  x, y;
+  uint32_t flags;
+  uint32_t format; // CaptureFormat, one of the pointer formats
+  uint32_t hx, hy;
+  uint32_t width, height;
+  uint32_t pitch;
+  uint32_t shapeSize;
+}
+ReplayCursor;
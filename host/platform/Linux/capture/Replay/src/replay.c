@@ -0,0 +1,569 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017-2019 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * Replays a recorded session (see replay.h) from a memory mapped file. The
+ * frames are handed to the host exactly as they were captured so that the
+ * transport can be measured against real content without a guest.
+ *
+ * Playback does not move past a frame until it has been taken by getFrame,
+ * so every recorded frame is sent once with its own damage.
+ */
+
+#include "replay.h"
+#include "interface/capture.h"
+#include "interface/platform.h"
+#include "common/debug.h"
+#include "common/event.h"
+#include "common/option.h"
+#include "common/time.h"
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct replay
+{
+  bool               initialized;
+  atomic_bool        stop;
+  LGEvent          * stopEvent;
+
+  // a frame has been reached and not yet taken by getFrame
+  atomic_bool        ready;
+  LGEvent          * frameEvent;
+  LGEvent          * consumedEvent;
+
+  CaptureGetPointerBuffer  getPointerBufferFn;
+  CapturePostPointerBuffer postPointerBufferFn;
+  CaptureWriteFrame        writeFrameFn;
+
+  bool realtime;
+  bool loop;
+
+  int       fd;
+  uint8_t * map;
+  size_t    size;
+
+  unsigned int maxFrameSize;
+  unsigned int frameCount;
+
+  // playback state
+  size_t              pos;
+  uint64_t            startTime;  // local time the playback (re)started
+  uint64_t            startStamp; // timestamp of the first record
+  const ReplayFrame * frame;
+  bool                rewound;   // the next frame follows a rewind
+  bool                fullFrame; // the damage of frame does not apply
+  unsigned int        formatVer;
+  uint32_t            lastWidth, lastHeight, lastFormat;
+};
+
+struct replay * this = NULL;
+
+// forwards
+
+static bool replay_deinit();
+
+// implementation
+
+static const char * replay_getName(void)
+{
+  return "Replay";
+}
+
+static void replay_initOptions(void)
+{
+  struct Option options[] =
+  {
+    {
+      .module         = "replay",
+      .name           = "file",
+      .description    = "The recorded session to replay",
+      .type           = OPTION_TYPE_STRING,
+      .value.x_string = NULL
+    },
+    {
+      .module         = "replay",
+      .name           = "realtime",
+      .description    = "Replay with the original timing, otherwise as fast as possible",
+      .type           = OPTION_TYPE_BOOL,
+      .value.x_bool   = true
+    },
+    {
+      .module         = "replay",
+      .name           = "loop",
+      .description    = "Restart from the beginning when the end is reached",
+      .type           = OPTION_TYPE_BOOL,
+      .value.x_bool   = true
+    },
+    {
+      .module         = "replay",
+      .name           = "preload",
+      .description    = "Read the whole file into memory before starting so page faults don't skew the timing",
+      .type           = OPTION_TYPE_BOOL,
+      .value.x_bool   = true
+    },
+    {0}
+  };
+
+  option_register(options);
+}
+
+static bool replay_create(CaptureGetPointerBuffer getPointerBufferFn,
+    CapturePostPointerBuffer postPointerBufferFn, CaptureWriteFrame writeFrameFn)
+{
+  assert(!this);
+
+  // there is nothing to replay unless a file was given
+  const char * file = option_get_string("replay", "file");
+  if (!file || !*file)
+    return false;
+
+  this                = (struct replay *)calloc(sizeof(struct replay), 1);
+  this->fd            = -1;
+  this->stopEvent     = lgCreateEvent(true, 0);
+  this->frameEvent    = lgCreateEvent(true, 0);
+  this->consumedEvent = lgCreateEvent(true, 0);
+  if (!this->stopEvent || !this->frameEvent || !this->consumedEvent)
+  {
+    DEBUG_ERROR("Failed to create the events");
+    if (this->stopEvent)
+      lgFreeEvent(this->stopEvent);
+    if (this->frameEvent)
+      lgFreeEvent(this->frameEvent);
+    if (this->consumedEvent)
+      lgFreeEvent(this->consumedEvent);
+    free(this);
+    this = NULL;
+    return false;
+  }
+
+  this->getPointerBufferFn  = getPointerBufferFn;
+  this->postPointerBufferFn = postPointerBufferFn;
+  this->writeFrameFn        = writeFrameFn;
+  return true;
+}
+
+static unsigned int replay_bpp(uint32_t format)
+{
+  switch(format)
+  {
+    case CAPTURE_FMT_BGRA   :
+    case CAPTURE_FMT_RGBA   :
+    case CAPTURE_FMT_RGBA10 : return 4;
+    case CAPTURE_FMT_RGBA16F: return 8;
+    default:
+      return 0;
+  }
+}
+
+// check every record is within the file so playback doesn't need to
+static bool replay_validate(void)
+{
+  const ReplayHeader * hdr = (const ReplayHeader *)this->map;
+  if (this->size < sizeof(*hdr) ||
+      memcmp(hdr->magic, REPLAY_MAGIC, sizeof(hdr->magic)) != 0)
+  {
+    DEBUG_ERROR("Not a recorded session file");
+    return false;
+  }
+
+  if (hdr->version != REPLAY_VERSION)
+  {
+    DEBUG_ERROR("Unsupported recording version %u, expected %u",
+        hdr->version, REPLAY_VERSION);
+    return false;
+  }
+
+  this->maxFrameSize = 0;
+  this->frameCount   = 0;
+
+  for(size_t pos = REPLAY_ALIGN_UP(sizeof(*hdr)); pos < this->size;)
+  {
+    const ReplayRecord * rec = (const ReplayRecord *)(this->map + pos);
+    if (this->size - pos < sizeof(*rec) ||
+        this->size - pos - sizeof(*rec) < rec->size)
+    {
+      DEBUG_ERROR("Truncated record at offset %zu", pos);
+      return false;
+    }
+
+    const uint8_t * payload = (const uint8_t *)(rec + 1);
+    switch(rec->type)
+    {
+      case REPLAY_RECORD_FRAME:
+      {
+        const ReplayFrame * frame = (const ReplayFrame *)payload;
+        if (rec->size < sizeof(*frame))
+        {
+          DEBUG_ERROR("Invalid frame record at offset %zu", pos);
+          return false;
+        }
+
+        const unsigned int bpp = replay_bpp(frame->format);
+        const uint64_t dataSize = (uint64_t)frame->pitch * frame->height;
+        if (!bpp || frame->pitch < frame->width * bpp ||
+            frame->damageRectsCount > KVMFR_MAX_DAMAGE_RECTS ||
+            frame->dataOffset < sizeof(*frame) ||
+            frame->dataOffset > rec->size ||
+            rec->size - frame->dataOffset < dataSize)
+        {
+          DEBUG_ERROR("Invalid frame record at offset %zu", pos);
+          return false;
+        }
+
+        if (dataSize > this->maxFrameSize)
+          this->maxFrameSize = dataSize;
+        ++this->frameCount;
+        break;
+      }
+
+      case REPLAY_RECORD_CURSOR:
+      {
+        const ReplayCursor * cursor = (const ReplayCursor *)payload;
+        if (rec->size < sizeof(*cursor) ||
+            rec->size - sizeof(*cursor) < cursor->shapeSize ||
+            ((cursor->flags & REPLAY_CURSOR_FLAG_SHAPE) &&
+             (cursor->format < CAPTURE_FMT_COLOR ||
+              cursor->format > CAPTURE_FMT_MASKED)))
+        {
+          DEBUG_ERROR("Invalid cursor record at offset %zu", pos);
+          return false;
+        }
+        break;
+      }
+
+      default:
+        DEBUG_WARN("Skipping unknown record type %u at offset %zu",
+            rec->type, pos);
+        break;
+    }
+
+    pos = REPLAY_ALIGN_UP(pos + sizeof(*rec) + rec->size);
+  }
+
+  if (!this->frameCount)
+  {
+    DEBUG_ERROR("The recording does not contain any frames");
+    return false;
+  }
+
+  return true;
+}
+
+/* the damage of the first frame after a rewind is relative to a frame the
+ * client never saw, so that frame is sent in full */
+static void replay_rewind(void)
+{
+  this->rewound    = true;
+  this->pos        = REPLAY_ALIGN_UP(sizeof(ReplayHeader));
+  this->startTime  = microtime();
+  this->startStamp = this->pos < this->size ?
+    ((const ReplayRecord *)(this->map + this->pos))->timestamp : 0;
+}
+
+static bool replay_init(void)
+{
+  assert(this);
+  assert(!this->initialized);
+
+  const char * file = option_get_string("replay", "file");
+  const bool preload = option_get_bool("replay", "preload");
+  this->realtime     = option_get_bool("replay", "realtime");
+  this->loop         = option_get_bool("replay", "loop");
+
+  this->fd = open(file, O_RDONLY);
+  if (this->fd < 0)
+  {
+    DEBUG_ERROR("Failed to open: %s", file);
+    return replay_deinit();
+  }
+
+  struct stat st;
+  if (fstat(this->fd, &st) != 0 || st.st_size <= 0)
+  {
+    DEBUG_ERROR("Failed to stat: %s", file);
+    return replay_deinit();
+  }
+
+  this->size = st.st_size;
+  this->map  = mmap(NULL, this->size, PROT_READ,
+      MAP_SHARED | (preload ? MAP_POPULATE : 0), this->fd, 0);
+  if (this->map == MAP_FAILED)
+  {
+    this->map = NULL;
+    DEBUG_ERROR("Failed to map: %s", file);
+    return replay_deinit();
+  }
+
+  madvise(this->map, this->size, MADV_SEQUENTIAL);
+
+  if (!replay_validate())
+    return replay_deinit();
+
+  atomic_store(&this->stop , false);
+  atomic_store(&this->ready, false);
+  lgResetEvent(this->stopEvent    );
+  lgResetEvent(this->frameEvent   );
+  lgResetEvent(this->consumedEvent);
+
+  this->frame     = NULL;
+  this->formatVer = 0;
+  replay_rewind();
+
+  DEBUG_INFO("Replaying        : %s", file);
+  DEBUG_INFO("Frames           : %u", this->frameCount);
+  DEBUG_INFO("Timing           : %s", this->realtime ? "realtime" : "unlimited");
+
+  this->initialized = true;
+  return true;
+}
+
+static void replay_stop(void)
+{
+  atomic_store(&this->stop, true);
+  lgSignalEvent(this->stopEvent    );
+  lgSignalEvent(this->frameEvent   );
+  lgSignalEvent(this->consumedEvent);
+}
+
+static bool replay_deinit(void)
+{
+  assert(this);
+
+  if (this->map)
+  {
+    munmap(this->map, this->size);
+    this->map = NULL;
+  }
+
+  if (this->fd >= 0)
+  {
+    close(this->fd);
+    this->fd = -1;
+  }
+
+  this->initialized = false;
+  return false;
+}
+
+static void replay_free(void)
+{
+  lgFreeEvent(this->stopEvent    );
+  lgFreeEvent(this->frameEvent   );
+  lgFreeEvent(this->consumedEvent);
+  free(this);
+  this = NULL;
+}
+
+static unsigned int replay_getMaxFrameSize(void)
+{
+  return this->maxFrameSize;
+}
+
+static unsigned int replay_getMouseScale(void)
+{
+  return 100;
+}
+
+// wait until the local time catches up to the record, false if stopped
+static bool replay_waitUntil(uint64_t timestamp)
+{
+  if (timestamp < this->startStamp)
+    timestamp = this->startStamp;
+
+  const uint64_t target = this->startTime + (timestamp - this->startStamp);
+  for(uint64_t now = microtime(); now < target; now = microtime())
+  {
+    if (atomic_load(&this->stop))
+      return false;
+
+    const uint64_t remaining = target - now;
+    if (remaining >= 1000)
+      lgWaitEvent(this->stopEvent, remaining / 1000);
+    else
+      nsleep(remaining * 1000);
+  }
+
+  return !atomic_load(&this->stop);
+}
+
+static void replay_postCursor(const ReplayCursor * cursor)
+{
+  CapturePointer pointer = { 0 };
+
+  pointer.positionUpdate = cursor->flags & REPLAY_CURSOR_FLAG_POSITION;
+  pointer.x              = cursor->x;
+  pointer.y              = cursor->y;
+  pointer.visible        = cursor->flags & REPLAY_CURSOR_FLAG_VISIBLE;
+
+  void   * data;
+  uint32_t size;
+  if ((cursor->flags & REPLAY_CURSOR_FLAG_SHAPE) &&
+      this->getPointerBufferFn(&data, &size))
+  {
+    if (cursor->shapeSize > size)
+      DEBUG_WARN("Cursor shape is too large for the pointer buffer");
+    else
+    {
+      memcpy(data, cursor + 1, cursor->shapeSize);
+      pointer.shapeUpdate = true;
+      pointer.format      = cursor->format;
+      pointer.hx          = cursor->hx;
+      pointer.hy          = cursor->hy;
+      pointer.width       = cursor->width;
+      pointer.height      = cursor->height;
+      pointer.pitch       = cursor->pitch;
+    }
+  }
+
+  this->postPointerBufferFn(pointer);
+}
+
+static CaptureResult replay_capture(void)
+{
+  assert(this);
+  assert(this->initialized);
+
+  // don't move past the last frame until it has been taken
+  while(atomic_load_explicit(&this->ready, memory_order_acquire))
+  {
+    if (atomic_load(&this->stop) ||
+        !lgWaitEvent(this->consumedEvent, 1000))
+      return CAPTURE_RESULT_TIMEOUT;
+  }
+
+  for(;;)
+  {
+    if (atomic_load(&this->stop))
+      return CAPTURE_RESULT_TIMEOUT;
+
+    if (this->pos >= this->size)
+    {
+      if (!this->loop)
+      {
+        // hold the last frame
+        lgWaitEvent(this->stopEvent, 100);
+        return CAPTURE_RESULT_TIMEOUT;
+      }
+
+      replay_rewind();
+    }
+
+    const ReplayRecord * rec = (const ReplayRecord *)(this->map + this->pos);
+    if (this->realtime && !replay_waitUntil(rec->timestamp))
+      return CAPTURE_RESULT_TIMEOUT;
+
+    this->pos = REPLAY_ALIGN_UP(this->pos + sizeof(*rec) + rec->size);
+
+    switch(rec->type)
+    {
+      case REPLAY_RECORD_CURSOR:
+        replay_postCursor((const ReplayCursor *)(rec + 1));
+        break;
+
+      case REPLAY_RECORD_FRAME:
+        this->frame     = (const ReplayFrame *)(rec + 1);
+        this->fullFrame = this->rewound;
+        this->rewound   = false;
+        atomic_store_explicit(&this->ready, true, memory_order_release);
+        lgSignalEvent(this->frameEvent);
+        return CAPTURE_RESULT_OK;
+    }
+  }
+}
+
+static CaptureResult replay_waitFrame(CaptureFrame * frame)
+{
+  assert(this);
+  assert(this->initialized);
+
+  while(!atomic_load_explicit(&this->ready, memory_order_acquire))
+  {
+    if (atomic_load(&this->stop) ||
+        !lgWaitEvent(this->frameEvent, 1000))
+      return CAPTURE_RESULT_TIMEOUT;
+  }
+
+  const ReplayFrame * rf = this->frame;
+  if (this->formatVer == 0         ||
+      rf->width  != this->lastWidth  ||
+      rf->height != this->lastHeight ||
+      rf->format != this->lastFormat)
+  {
+    this->lastWidth  = rf->width;
+    this->lastHeight = rf->height;
+    this->lastFormat = rf->format;
+    ++this->formatVer;
+  }
+
+  frame->formatVer        = this->formatVer;
+  frame->output           = 0;
+  frame->width            = rf->width;
+  frame->height           = rf->height;
+  frame->pitch            = rf->pitch;
+  frame->stride           = rf->stride;
+  frame->format           = rf->format;
+  frame->rotation         = CAPTURE_ROT_0;
+  frame->damageRectsCount = this->fullFrame ? 0 : rf->damageRectsCount;
+  memcpy(frame->damageRects, rf->damageRects,
+      frame->damageRectsCount * sizeof(FrameDamageRect));
+
+  return CAPTURE_RESULT_OK;
+}
+
+static CaptureResult replay_getFrame(FrameBuffer * frame)
+{
+  assert(this);
+  assert(this->initialized);
+
+  // written straight from the mapping, there is no decoding
+  const ReplayFrame * rf = this->frame;
+  const bool ok = this->writeFrameFn(frame,
+      (const uint8_t *)rf + rf->dataOffset, rf->pitch * rf->height);
+
+  // playback may now move on
+  atomic_store_explicit(&this->ready, false, memory_order_release);
+  lgSignalEvent(this->consumedEvent);
+
+  return ok ? CAPTURE_RESULT_OK : CAPTURE_RESULT_ERROR;
+}
+
+struct CaptureInterface Capture_Replay =
+{
+  .shortName       = "Replay",
+  .getName         = replay_getName,
+  .initOptions     = replay_initOptions,
+  .create          = replay_create,
+  .init            = replay_init,
+  .stop            = replay_stop,
+  .deinit          = replay_deinit,
+  .free            = replay_free,
+  .getMaxFrameSize = replay_getMaxFrameSize,
+  .getMouseScale   = replay_getMouseScale,
+  .capture         = replay_capture,
+  .waitFrame       = replay_waitFrame,
+  .getFrame        = replay_getFrame
+};
@@ -0,0 +1,595 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017-2019 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * Generates a deterministic test pattern instead of capturing a display so
+ * that the transport and the client can be load tested on a headless machine.
+ * Each frame a band of rows moves down the screen and is redrawn, the size of
+ * the band is set by the change ratio. The cursor bounces around the screen
+ * and its shape is changed periodically.
+ *
+ * The next frame is not drawn until the previous one has been taken by
+ * getFrame, so every frame is sent exactly once with its own damage.
+ */
+
+#include "interface/capture.h"
+#include "interface/platform.h"
+#include "common/debug.h"
+#include "common/event.h"
+#include "common/option.h"
+#include "common/time.h"
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+// the number of frames between cursor shape changes
+#define CURSOR_SHAPE_FRAMES 120
+#define CURSOR_SHAPES       4
+#define CURSOR_SIZE         32
+
+struct synthetic
+{
+  bool               initialized;
+  atomic_bool        stop;
+  LGEvent          * stopEvent;
+
+  // a frame has been drawn and not yet taken by getFrame
+  atomic_bool        ready;
+  LGEvent          * frameEvent;
+  LGEvent          * consumedEvent;
+
+  CaptureGetPointerBuffer  getPointerBufferFn;
+  CapturePostPointerBuffer postPointerBufferFn;
+  CaptureWriteFrame        writeFrameFn;
+
+  unsigned int  width, height;
+  unsigned int  bpp;
+  CaptureFormat format;
+  unsigned int  changeRatio;
+  bool          cursor;
+  uint64_t      interval;
+
+  uint8_t     * data;
+  unsigned int  pitch;
+  uint32_t      frame;
+  uint64_t      next;
+  bool          fullFrame;
+
+  // the rows redrawn for the last frame
+  unsigned int  bandY, bandHeight;
+
+  // the damage of the frame that is ready
+  unsigned int    damageRectsCount;
+  FrameDamageRect damageRects[2];
+
+  int           cursorX , cursorY;
+  int           cursorDX, cursorDY;
+};
+
+struct synthetic * this = NULL;
+
+// forwards
+
+static bool synthetic_deinit();
+
+// implementation
+
+static const char * synthetic_getName(void)
+{
+  return "Synthetic";
+}
+
+static bool synthetic_parseFormat(const char * str, CaptureFormat * format)
+{
+       if (strcasecmp(str, "BGRA"   ) == 0) *format = CAPTURE_FMT_BGRA;
+  else if (strcasecmp(str, "RGBA"   ) == 0) *format = CAPTURE_FMT_RGBA;
+  else if (strcasecmp(str, "RGBA10" ) == 0) *format = CAPTURE_FMT_RGBA10;
+  else if (strcasecmp(str, "RGBA16F") == 0) *format = CAPTURE_FMT_RGBA16F;
+  else
+    return false;
+
+  return true;
+}
+
+static bool synthetic_validateFormat(struct Option * opt, const char ** error)
+{
+  CaptureFormat format;
+  if (synthetic_parseFormat(opt->value.x_string, &format))
+    return true;
+
+  *error = "Invalid format, valid values are BGRA, RGBA, RGBA10 and RGBA16F";
+  return false;
+}
+
+static bool synthetic_validateSize(struct Option * opt, const char ** error)
+{
+  if (opt->value.x_int >= CURSOR_SIZE && opt->value.x_int <= 16384)
+    return true;
+
+  *error = "Invalid size, valid values are 32 to 16384";
+  return false;
+}
+
+static bool synthetic_validateFPS(struct Option * opt, const char ** error)
+{
+  if (opt->value.x_int >= 0 && opt->value.x_int <= 1000)
+    return true;
+
+  *error = "Invalid frame rate, valid values are 0 (unlimited) to 1000";
+  return false;
+}
+
+static bool synthetic_validateChangeRatio(struct Option * opt,
+    const char ** error)
+{
+  if (opt->value.x_int >= 0 && opt->value.x_int <= 100)
+    return true;
+
+  *error = "Invalid change ratio, valid values are 0 to 100";
+  return false;
+}
+
+static void synthetic_initOptions(void)
+{
+  struct Option options[] =
+  {
+    {
+      .module         = "synthetic",
+      .name           = "width",
+      .description    = "The width of the generated frames",
+      .type           = OPTION_TYPE_INT,
+      .value.x_int    = 1920,
+      .validator      = synthetic_validateSize
+    },
+    {
+      .module         = "synthetic",
+      .name           = "height",
+      .description    = "The height of the generated frames",
+      .type           = OPTION_TYPE_INT,
+      .value.x_int    = 1080,
+      .validator      = synthetic_validateSize
+    },
+    {
+      .module         = "synthetic",
+      .name           = "format",
+      .description    = "The format of the generated frames (BGRA, RGBA, RGBA10 or RGBA16F)",
+      .type           = OPTION_TYPE_STRING,
+      .value.x_string = "BGRA",
+      .validator      = synthetic_validateFormat
+    },
+    {
+      .module         = "synthetic",
+      .name           = "fps",
+      .description    = "The rate to generate frames at (0 = unlimited)",
+      .type           = OPTION_TYPE_INT,
+      .value.x_int    = 60,
+      .validator      = synthetic_validateFPS
+    },
+    {
+      .module         = "synthetic",
+      .name           = "changeRatio",
+      .description    = "The percentage of the frame that changes each frame (0 = static)",
+      .type           = OPTION_TYPE_INT,
+      .value.x_int    = 10,
+      .validator      = synthetic_validateChangeRatio
+    },
+    {
+      .module         = "synthetic",
+      .name           = "cursor",
+      .description    = "Generate cursor motion and shape changes",
+      .type           = OPTION_TYPE_BOOL,
+      .value.x_bool   = true
+    },
+    {0}
+  };
+
+  option_register(options);
+}
+
+static bool synthetic_create(CaptureGetPointerBuffer getPointerBufferFn,
+    CapturePostPointerBuffer postPointerBufferFn, CaptureWriteFrame writeFrameFn)
+{
+  assert(!this);
+
+  /* never fall back to a test pattern, this interface is only used when it
+   * has been explicitly selected */
+  const char * ifaceName = option_get_string("app", "capture");
+  if (!ifaceName || strcasecmp(ifaceName, "Synthetic") != 0)
+    return false;
+
+  this                = (struct synthetic *)calloc(sizeof(struct synthetic), 1);
+  this->stopEvent     = lgCreateEvent(true, 0);
+  this->frameEvent    = lgCreateEvent(true, 0);
+  this->consumedEvent = lgCreateEvent(true, 0);
+  if (!this->stopEvent || !this->frameEvent || !this->consumedEvent)
+  {
+    DEBUG_ERROR("Failed to create the events");
+    if (this->stopEvent)
+      lgFreeEvent(this->stopEvent);
+    if (this->frameEvent)
+      lgFreeEvent(this->frameEvent);
+    if (this->consumedEvent)
+      lgFreeEvent(this->consumedEvent);
+    free(this);
+    this = NULL;
+    return false;
+  }
+
+  this->getPointerBufferFn  = getPointerBufferFn;
+  this->postPointerBufferFn = postPointerBufferFn;
+  this->writeFrameFn        = writeFrameFn;
+  return true;
+}
+
+static bool synthetic_init(void)
+{
+  assert(this);
+  assert(!this->initialized);
+
+  synthetic_parseFormat(option_get_string("synthetic", "format"),
+      &this->format);
+
+  const int fps = option_get_int("synthetic", "fps");
+  this->width       = option_get_int ("synthetic", "width"      );
+  this->height      = option_get_int ("synthetic", "height"     );
+  this->changeRatio = option_get_int ("synthetic", "changeRatio");
+  this->cursor      = option_get_bool("synthetic", "cursor"     );
+  this->interval    = fps > 0 ? 1000000 / fps : 0;
+  this->bpp         = this->format == CAPTURE_FMT_RGBA16F ? 8 : 4;
+  this->pitch       = this->width * this->bpp;
+
+  this->data = malloc(this->pitch * this->height);
+  if (!this->data)
+  {
+    DEBUG_ERROR("Failed to allocate the frame buffer");
+    return synthetic_deinit();
+  }
+
+  atomic_store(&this->stop , false);
+  atomic_store(&this->ready, false);
+  lgResetEvent(this->stopEvent    );
+  lgResetEvent(this->frameEvent   );
+  lgResetEvent(this->consumedEvent);
+
+  this->frame     = 0;
+  this->next      = microtime();
+  this->fullFrame = true;
+  this->cursorX   = this->width  / 2;
+  this->cursorY   = this->height / 2;
+  this->cursorDX  = 7;
+  this->cursorDY  = 5;
+
+  DEBUG_INFO("Frame Size       : %u x %u", this->width, this->height);
+  DEBUG_INFO("Frame Rate       : %d", fps);
+  DEBUG_INFO("Change Ratio     : %u%%", this->changeRatio);
+
+  this->initialized = true;
+  return true;
+}
+
+static void synthetic_stop(void)
+{
+  atomic_store(&this->stop, true);
+  lgSignalEvent(this->stopEvent    );
+  lgSignalEvent(this->frameEvent   );
+  lgSignalEvent(this->consumedEvent);
+}
+
+static bool synthetic_deinit(void)
+{
+  assert(this);
+
+  free(this->data);
+  this->data = NULL;
+
+  this->initialized = false;
+  return false;
+}
+
+static void synthetic_free(void)
+{
+  lgFreeEvent(this->stopEvent    );
+  lgFreeEvent(this->frameEvent   );
+  lgFreeEvent(this->consumedEvent);
+  free(this);
+  this = NULL;
+}
+
+static unsigned int synthetic_getMaxFrameSize(void)
+{
+  return this->pitch * this->height;
+}
+
+static unsigned int synthetic_getMouseScale(void)
+{
+  return 100;
+}
+
+// draw a row of the pattern, the content depends only on the row and frame
+static void synthetic_drawRow(unsigned int y, uint32_t frame)
+{
+  const uint32_t seed = (y * 0x9E3779B1u) ^ (frame * 0x85EBCA77u);
+  uint8_t * row = this->data + y * this->pitch;
+
+  if (this->bpp == 8)
+  {
+    // half floats in the range 0.5 to 1.0 with an alpha of 1.0
+    uint16_t * px = (uint16_t *)row;
+    for(unsigned int x = 0; x < this->width; ++x, px += 4)
+    {
+      const uint32_t v = seed + x * 0x01010101u;
+      px[0] = 0x3800 | ( v        & 0x3FF);
+      px[1] = 0x3800 | ((v >> 10) & 0x3FF);
+      px[2] = 0x3800 | ((v >> 20) & 0x3FF);
+      px[3] = 0x3C00;
+    }
+    return;
+  }
+
+  // the top bits are the alpha for all of the 32-bit formats
+  const uint32_t alpha =
+    this->format == CAPTURE_FMT_RGBA10 ? 0xC0000000u : 0xFF000000u;
+
+  uint32_t * px = (uint32_t *)row;
+  for(unsigned int x = 0; x < this->width; ++x)
+    px[x] = alpha | ((seed + x * 0x01010101u) & ~alpha);
+}
+
+static void synthetic_postCursor(void)
+{
+  CapturePointer pointer = { 0 };
+
+  this->cursorX += this->cursorDX;
+  this->cursorY += this->cursorDY;
+  if (this->cursorX < 0 || this->cursorX >= (int)this->width)
+  {
+    this->cursorDX = -this->cursorDX;
+    this->cursorX += this->cursorDX * 2;
+  }
+  if (this->cursorY < 0 || this->cursorY >= (int)this->height)
+  {
+    this->cursorDY = -this->cursorDY;
+    this->cursorY += this->cursorDY * 2;
+  }
+
+  pointer.positionUpdate = true;
+  pointer.x              = this->cursorX;
+  pointer.y              = this->cursorY;
+  pointer.visible        = true;
+
+  void   * data;
+  uint32_t size;
+  if (this->frame % CURSOR_SHAPE_FRAMES == 0 &&
+      this->getPointerBufferFn(&data, &size))
+  {
+    /* cycle through a set of colour and monochrome shapes so both paths
+     * and the shape caches are exercised */
+    const unsigned int shape = (this->frame / CURSOR_SHAPE_FRAMES) %
+      CURSOR_SHAPES;
+
+    pointer.width  = CURSOR_SIZE;
+    pointer.height = CURSOR_SIZE;
+    pointer.hx     = shape * 4;
+    pointer.hy     = shape * 4;
+
+    if (shape & 1)
+    {
+      // monochrome, an AND mask followed by an XOR mask
+      pointer.format = CAPTURE_FMT_MONO;
+      pointer.pitch  = CURSOR_SIZE / 8;
+      if (size >= pointer.pitch * CURSOR_SIZE * 2)
+      {
+        uint8_t * andMask = data;
+        uint8_t * xorMask = andMask + pointer.pitch * CURSOR_SIZE;
+        for(unsigned int y = 0; y < CURSOR_SIZE; ++y)
+          for(unsigned int x = 0; x < pointer.pitch; ++x)
+          {
+            const bool border = y < 2 || y >= CURSOR_SIZE - 2;
+            andMask[y * pointer.pitch + x] = 0x00;
+            xorMask[y * pointer.pitch + x] = border ? 0xFF :
+              (shape == 1 ? 0x81 : 0x18);
+          }
+        pointer.shapeUpdate = true;
+      }
+    }
+    else
+    {
+      pointer.format = CAPTURE_FMT_COLOR;
+      pointer.pitch  = CURSOR_SIZE * 4;
+      if (size >= pointer.pitch * CURSOR_SIZE)
+      {
+        const uint32_t colour = shape == 0 ? 0xFFFFFFFF : 0xFF20C020;
+        uint32_t * px = data;
+        for(unsigned int y = 0; y < CURSOR_SIZE; ++y)
+          for(unsigned int x = 0; x < CURSOR_SIZE; ++x)
+            px[y * CURSOR_SIZE + x] = x <= y ? colour : 0x00000000;
+        pointer.shapeUpdate = true;
+      }
+    }
+  }
+
+  this->postPointerBufferFn(pointer);
+}
+
+// set the damage of the frame from the band that was redrawn
+static void synthetic_setDamage(void)
+{
+  if (this->bandHeight == this->height)
+  {
+    this->damageRectsCount = 0;
+    return;
+  }
+
+  // the band wraps at the bottom of the frame into a second rect
+  const unsigned int first = this->bandY + this->bandHeight > this->height ?
+    this->height - this->bandY : this->bandHeight;
+
+  this->damageRects[0] = (FrameDamageRect)
+  {
+    .x      = 0,
+    .y      = this->bandY,
+    .width  = this->width,
+    .height = first
+  };
+  this->damageRectsCount = 1;
+
+  if (first < this->bandHeight)
+  {
+    this->damageRects[1] = (FrameDamageRect)
+    {
+      .x      = 0,
+      .y      = 0,
+      .width  = this->width,
+      .height = this->bandHeight - first
+    };
+    this->damageRectsCount = 2;
+  }
+}
+
+static CaptureResult synthetic_capture(void)
+{
+  assert(this);
+  assert(this->initialized);
+
+  // the frame is drawn in place, wait until the last one has been taken
+  while(atomic_load_explicit(&this->ready, memory_order_acquire))
+  {
+    if (atomic_load(&this->stop) ||
+        !lgWaitEvent(this->consumedEvent, 1000))
+      return CAPTURE_RESULT_TIMEOUT;
+  }
+
+  // pace the frames to the configured rate
+  uint64_t now = microtime();
+  while(now < this->next)
+  {
+    if (atomic_load(&this->stop))
+      return CAPTURE_RESULT_TIMEOUT;
+
+    const uint64_t remaining = this->next - now;
+    if (remaining >= 1000)
+      lgWaitEvent(this->stopEvent, remaining / 1000);
+    else
+      nsleep(remaining * 1000);
+
+    now = microtime();
+  }
+
+  // don't try to catch up if we fell behind
+  this->next += this->interval;
+  if (this->next < now)
+    this->next = now;
+
+  if (atomic_load(&this->stop))
+    return CAPTURE_RESULT_TIMEOUT;
+
+  if (this->cursor)
+    synthetic_postCursor();
+
+  ++this->frame;
+
+  if (this->fullFrame)
+  {
+    for(unsigned int y = 0; y < this->height; ++y)
+      synthetic_drawRow(y, this->frame);
+    this->bandY      = 0;
+    this->bandHeight = this->height;
+    this->fullFrame  = false;
+  }
+  else
+  {
+    if (this->changeRatio == 0)
+      return CAPTURE_RESULT_TIMEOUT;
+
+    this->bandHeight = this->height * this->changeRatio / 100;
+    if (this->bandHeight == 0)
+      this->bandHeight = 1;
+
+    this->bandY = (this->bandY + this->bandHeight) % this->height;
+    for(unsigned int i = 0; i < this->bandHeight; ++i)
+      synthetic_drawRow((this->bandY + i) % this->height, this->frame);
+  }
+
+  synthetic_setDamage();
+  atomic_store_explicit(&this->ready, true, memory_order_release);
+  lgSignalEvent(this->frameEvent);
+  return CAPTURE_RESULT_OK;
+}
+
+static CaptureResult synthetic_waitFrame(CaptureFrame * frame)
+{
+  assert(this);
+  assert(this->initialized);
+
+  while(!atomic_load_explicit(&this->ready, memory_order_acquire))
+  {
+    if (atomic_load(&this->stop) ||
+        !lgWaitEvent(this->frameEvent, 1000))
+      return CAPTURE_RESULT_TIMEOUT;
+  }
+
+  frame->formatVer = 1;
+  frame->output    = 0;
+  frame->width     = this->width;
+  frame->height    = this->height;
+  frame->pitch     = this->pitch;
+  frame->stride    = this->width;
+  frame->format    = this->format;
+  frame->rotation  = CAPTURE_ROT_0;
+
+  frame->damageRectsCount = this->damageRectsCount;
+  memcpy(frame->damageRects, this->damageRects,
+      this->damageRectsCount * sizeof(FrameDamageRect));
+
+  return CAPTURE_RESULT_OK;
+}
+
+static CaptureResult synthetic_getFrame(FrameBuffer * frame)
+{
+  assert(this);
+  assert(this->initialized);
+
+  const bool ok =
+    this->writeFrameFn(frame, this->data, this->pitch * this->height);
+
+  // the next frame may now be drawn
+  atomic_store_explicit(&this->ready, false, memory_order_release);
+  lgSignalEvent(this->consumedEvent);
+
+  return ok ? CAPTURE_RESULT_OK : CAPTURE_RESULT_ERROR;
+}
+
+struct CaptureInterface Capture_Synthetic =
+{
+  .shortName       = "Synthetic",
+  .getName         = synthetic_getName,
+  .initOptions     = synthetic_initOptions,
+  .create          = synthetic_create,
+  .init            = synthetic_init,
+  .stop            = synthetic_stop,
+  .deinit          = synthetic_deinit,
+  .free            = synthetic_free,
+  .getMaxFrameSize = synthetic_getMaxFrameSize,
+  .getMouseScale   = synthetic_getMouseScale,
+  .capture         = synthetic_capture,
+  .waitFrame       = synthetic_waitFrame,
+  .getFrame        = synthetic_getFrame
+};
@@ -21,31 +21,130 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "interface/platform.h"
 #include "common/debug.h"
 #include "common/event.h"
+#include "common/option.h"
+#include "common/thread.h"
+#include "common/time.h"
+#include <stdio.h>
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
 #include <inttypes.h>
 #include <xcb/shm.h>
 #include <xcb/xfixes.h>
+#include <xcb/damage.h>
+#include <xcb/randr.h>
+#include <xcb/composite.h>
+#include <xcb/present.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
 
+// how long capture waits for damage or a vblank before reporting a timeout
+#define DAMAGE_TIMEOUT 100 // ms
+
+// how often the pointer position is sampled, shape changes are notified
+#define POINTER_INTERVAL 8 // ms
+
+// the most segments each output can have captures outstanding in
+#define MAX_BUFFERS 4
+
+/* a segment the X server captures into, each capture is a list of rectangles
+ * packed one after the other, a full frame is a single rectangle */
+struct xcbBuffer
+{
+  uint32_t seg;
+  int      shmID;
+  void   * data;
+
+  bool                       full;
+  unsigned int               rectCount;
+  FrameDamageRect            rects     [KVMFR_MAX_DAMAGE_RECTS];
+  unsigned int               rectOffset[KVMFR_MAX_DAMAGE_RECTS];
+  xcb_shm_get_image_cookie_t rectC     [KVMFR_MAX_DAMAGE_RECTS];
+};
+
+struct xcbOutput
+{
+  xcb_screen_t * xcbScreen;
+
+  /* the area captured, the damage and pointer are relative to the origin
+   * which is the root, or the window when capturing one */
+  xcb_drawable_t drawable;
+  int            srcX, srcY;
+  int            originX, originY;
+
+  unsigned int width;
+  unsigned int height;
+
+  /* the ring of buffers, capture requests into the head while the frame
+   * thread copies out of the tail */
+  struct xcbBuffer buffers[MAX_BUFFERS];
+  atomic_uint      head, tail;
+
+  // the damaged rectangles are merged into the frame which is kept here
+  uint8_t        * image;
+
+  xcb_damage_damage_t damage;
+  xcb_xfixes_region_t region;
+  bool                damaged;
+
+  // set by either thread when the next capture must be in full
+  atomic_bool         needFull;
+};
+
 struct xcb
 {
   bool               initialized;
+  atomic_bool        stop;
   xcb_connection_t * xcb;
-  xcb_screen_t     * xcbScreen;
-  uint32_t           seg;
-  int                shmID;
-  void             * data;
   LGEvent          * frameEvent;
+  LGEvent          * freeEvent; // the frame thread released a buffer
+  CaptureWriteFrame  writeFrameFn;
 
-  unsigned int width;
-  unsigned int height;
+  CaptureGetPointerBuffer  getPointerBufferFn;
+  CapturePostPointerBuffer postPointerBufferFn;
+
+  // the window being captured through Composite, if any
+  xcb_window_t       window;
+  bool               reinit;
 
-  bool                                 hasFrame;
-  xcb_shm_get_image_cookie_t           imgC;
-  xcb_xfixes_get_cursor_image_cookie_t curC;
+  // only capture what XDamage reports changed
+  bool               useDamage;
+  uint8_t            damageEvent;
+
+  /* capture after every Nth vblank, Present notifies us when each requested
+   * MSC is reached and the next one is requested as it arrives */
+  bool               vsync;
+  unsigned int       vsyncDivisor;
+  uint8_t            presentOpcode;
+  xcb_present_event_t presentEID;
+  xcb_window_t       presentWindow;
+  uint32_t           presentSerial;
+  bool               vblank;
+  uint64_t           lastUST, lastMSC;
+  unsigned int       frameInterval;
+
+  /* the shared memory the frames are written into, if it could be attached
+   * the X server places the frames directly in it */
+  struct IVSHMEM   * shm;
+  bool               zeroCopy;
+  uint32_t           shmSeg;
+
+  // each X screen is captured as a separate output
+  struct xcbOutput   outputs[KVMFR_MAX_OUTPUTS];
+  unsigned int       bufferCount;
+  unsigned int       outputCount;
+  unsigned int       current;
+
+  /* the pointer is tracked on its own connection so that its events and
+   * round trips do not delay the frames */
+  xcb_connection_t * pointerXcb;
+  xcb_window_t       pointerRoot;
+  uint8_t            pointerEvent;
+  LGThread         * pointerThread;
 };
 
 struct xcb * this = NULL;
@@ -62,30 +161,760 @@ static const char * xcb_getName(void)
   return "XCB";
 }
 
-static bool xcb_create(CaptureGetPointerBuffer getPointerBufferFn, CapturePostPointerBuffer postPointerBufferFn)
+static bool xcb_parseRegion(const char * str, struct Rect * rect)
+{
+  char end;
+  return sscanf(str, "%dx%d+%d+%d%c",
+      &rect->w, &rect->h, &rect->x, &rect->y, &end) == 4 &&
+    rect->w > 0 && rect->h > 0 && rect->x >= 0 && rect->y >= 0;
+}
+
+static bool xcb_validateRegion(struct Option * opt, const char ** error)
+{
+  struct Rect rect;
+  if (!opt->value.x_string || !*opt->value.x_string ||
+      xcb_parseRegion(opt->value.x_string, &rect))
+    return true;
+
+  *error = "Invalid region, the format is WxH+X+Y, ie: 1920x1080+1920+0";
+  return false;
+}
+
+static bool xcb_parseWindow(const char * str, xcb_window_t * window)
+{
+  char * end;
+  errno = 0;
+  const unsigned long id = strtoul(str, &end, 0);
+  if (errno || *end || end == str || !id || id > UINT32_MAX)
+    return false;
+
+  *window = id;
+  return true;
+}
+
+static bool xcb_validateWindow(struct Option * opt, const char ** error)
+{
+  xcb_window_t window;
+  if (!opt->value.x_string || !*opt->value.x_string ||
+      xcb_parseWindow(opt->value.x_string, &window))
+    return true;
+
+  *error = "Invalid window ID, ie: 0x4200003";
+  return false;
+}
+
+static bool xcb_validateDivisor(struct Option * opt, const char ** error)
+{
+  if (opt->value.x_int >= 1 && opt->value.x_int <= 60)
+    return true;
+
+  *error = "Invalid divisor, valid values are 1 to 60";
+  return false;
+}
+
+static bool xcb_validateBuffers(struct Option * opt, const char ** error)
+{
+  if (opt->value.x_int >= 1 && opt->value.x_int <= MAX_BUFFERS)
+    return true;
+
+  *error = "Invalid number of buffers, valid values are 1 to 4";
+  return false;
+}
+
+static void xcb_initOptions(void)
+{
+  struct Option options[] =
+  {
+    {
+      .module         = "xcb",
+      .name           = "damage",
+      .description    = "Only capture the areas of the screen that changed (requires XDamage)",
+      .type           = OPTION_TYPE_BOOL,
+      .value.x_bool   = true
+    },
+    {
+      .module         = "xcb",
+      .name           = "zeroCopy",
+      .description    = "Have the X server write the frames directly into the shared memory (requires MIT-SHM 1.2)",
+      .type           = OPTION_TYPE_BOOL,
+      .value.x_bool   = true
+    },
+    {
+      .module         = "xcb",
+      .name           = "buffers",
+      .description    = "The number of captures that can be in progress while the previous one is copied",
+      .type           = OPTION_TYPE_INT,
+      .value.x_int    = 2,
+      .validator      = xcb_validateBuffers
+    },
+    {
+      .module         = "xcb",
+      .name           = "vsync",
+      .description    = "Capture just after the guest's vertical blank (requires Present)",
+      .type           = OPTION_TYPE_BOOL,
+      .value.x_bool   = false
+    },
+    {
+      .module         = "xcb",
+      .name           = "vsyncDivisor",
+      .description    = "Only capture after every Nth vertical blank when xcb:vsync is set",
+      .type           = OPTION_TYPE_INT,
+      .value.x_int    = 1,
+      .validator      = xcb_validateDivisor
+    },
+    {
+      .module         = "xcb",
+      .name           = "output",
+      .description    = "Only capture the RandR output with this name, ie: HDMI-1",
+      .type           = OPTION_TYPE_STRING,
+      .value.x_string = NULL
+    },
+    {
+      .module         = "xcb",
+      .name           = "region",
+      .description    = "Only capture this area of the screen (WxH+X+Y)",
+      .type           = OPTION_TYPE_STRING,
+      .value.x_string = NULL,
+      .validator      = xcb_validateRegion
+    },
+    {
+      .module         = "xcb",
+      .name           = "window",
+      .description    = "Only capture the window with this ID (requires Composite)",
+      .type           = OPTION_TYPE_STRING,
+      .value.x_string = NULL,
+      .validator      = xcb_validateWindow
+    },
+    {0}
+  };
+
+  option_register(options);
+}
+
+static void xcb_setSharedMemory(struct IVSHMEM * shm)
+{
+  this->shm = shm;
+}
+
+// attach the shared memory file to the X server by passing its descriptor
+static bool xcb_initZeroCopy(void)
+{
+  xcb_shm_query_version_reply_t * ver = xcb_shm_query_version_reply(
+      this->xcb, xcb_shm_query_version(this->xcb), NULL);
+
+  const bool hasFd = ver && (ver->major_version > 1 ||
+      (ver->major_version == 1 && ver->minor_version >= 2));
+  free(ver);
+
+  if (!hasFd)
+  {
+    DEBUG_WARN("MIT-SHM 1.2 is not supported, frames will be copied");
+    return false;
+  }
+
+  // the descriptor is closed by xcb once it has been sent
+  const int fd = dup(ivshmemGetFd(this->shm));
+  if (fd < 0)
+  {
+    DEBUG_ERROR("Failed to duplicate the shared memory descriptor");
+    return false;
+  }
+
+  this->shmSeg = xcb_generate_id(this->xcb);
+  xcb_generic_error_t * error = xcb_request_check(this->xcb,
+      xcb_shm_attach_fd_checked(this->xcb, this->shmSeg, fd, false));
+  if (error)
+  {
+    DEBUG_WARN("The X server could not attach the shared memory (error %d), "
+        "frames will be copied", error->error_code);
+    free(error);
+    return false;
+  }
+
+  DEBUG_INFO("Frames are captured directly into the shared memory");
+  return true;
+}
+
+// ask Present to notify us when the target MSC of the window is reached
+static bool xcb_initVSync(void)
+{
+  if (!xcb_get_extension_data(this->xcb, &xcb_present_id)->present)
+  {
+    DEBUG_WARN("Present is missing, captures will not be paced to vblank");
+    return false;
+  }
+
+  xcb_present_query_version_reply_t * ver = xcb_present_query_version_reply(
+      this->xcb, xcb_present_query_version(this->xcb, 1, 0), NULL);
+  if (!ver)
+  {
+    DEBUG_WARN("Failed to query the Present version, captures will not be "
+        "paced to vblank");
+    return false;
+  }
+  free(ver);
+
+  // the CRTC is the one that shows most of the window
+  this->presentOpcode =
+    xcb_get_extension_data(this->xcb, &xcb_present_id)->major_opcode;
+  this->presentWindow = this->window ?
+    this->window : this->outputs[0].xcbScreen->root;
+  this->presentEID    = xcb_generate_id(this->xcb);
+  this->vsyncDivisor  = option_get_int("xcb", "vsyncDivisor");
+  this->vblank        = false;
+  this->lastUST       = 0;
+  this->lastMSC       = 0;
+  this->frameInterval = 0;
+
+  xcb_present_select_input(this->xcb, this->presentEID, this->presentWindow,
+      XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY);
+  xcb_present_notify_msc(this->xcb, this->presentWindow,
+      ++this->presentSerial, 0, this->vsyncDivisor, 0);
+
+  DEBUG_INFO("Pacing captures to every %u vblank(s)", this->vsyncDivisor);
+  return true;
+}
+
+// a requested MSC was reached, request the next one and sample the interval
+static void xcb_onVBlank(const xcb_present_complete_notify_event_t * notify)
+{
+  if (notify->event != this->presentEID ||
+      notify->kind  != XCB_PRESENT_COMPLETE_KIND_NOTIFY_MSC)
+    return;
+
+  xcb_present_notify_msc(this->xcb, this->presentWindow,
+      ++this->presentSerial, notify->msc + this->vsyncDivisor, 0, 0);
+
+  /* a notification handled late delays the next request, scale by the MSC
+   * to get the interval at the requested rate */
+  if (this->lastMSC && notify->msc > this->lastMSC &&
+      notify->ust > this->lastUST)
+  {
+    const uint64_t sample = (notify->ust - this->lastUST) *
+      this->vsyncDivisor / (notify->msc - this->lastMSC);
+
+    this->frameInterval = this->frameInterval ?
+      (this->frameInterval * 7 + sample) / 8 : sample;
+  }
+
+  this->lastUST = notify->ust;
+  this->lastMSC = notify->msc;
+  this->vblank  = true;
+}
+
+static bool xcb_initDamage(void)
+{
+  if (!xcb_get_extension_data(this->xcb, &xcb_damage_id)->present ||
+      !xcb_get_extension_data(this->xcb, &xcb_xfixes_id)->present)
+  {
+    DEBUG_WARN("XDamage or XFixes is missing, capturing every frame in full");
+    return false;
+  }
+
+  // both extensions must be told which version we speak before use
+  xcb_xfixes_query_version_reply_t * fixes = xcb_xfixes_query_version_reply(
+      this->xcb, xcb_xfixes_query_version(this->xcb, 2, 0), NULL);
+  xcb_damage_query_version_reply_t * damage = xcb_damage_query_version_reply(
+      this->xcb, xcb_damage_query_version(this->xcb, 1, 1), NULL);
+
+  const bool ok = fixes && damage && fixes->major_version >= 2;
+  free(fixes);
+  free(damage);
+
+  if (!ok)
+  {
+    DEBUG_WARN("XFixes 2.0 is not supported, capturing every frame in full");
+    return false;
+  }
+
+  this->damageEvent =
+    xcb_get_extension_data(this->xcb, &xcb_damage_id)->first_event;
+  return true;
+}
+
+static bool xcb_create(CaptureGetPointerBuffer getPointerBufferFn,
+    CapturePostPointerBuffer postPointerBufferFn, CaptureWriteFrame writeFrameFn)
 {
   assert(!this);
   this             = (struct xcb *)calloc(sizeof(struct xcb), 1);
-  this->shmID      = -1;
-  this->data       = (void *)-1;
   this->frameEvent = lgCreateEvent(true, 20);
+  this->freeEvent  = lgCreateEvent(true, 0);
 
-  if (!this->frameEvent)
+  for(int i = 0; i < KVMFR_MAX_OUTPUTS; ++i)
+    for(int j = 0; j < MAX_BUFFERS; ++j)
+    {
+      this->outputs[i].buffers[j].shmID = -1;
+      this->outputs[i].buffers[j].data  = (void *)-1;
+    }
+
+  if (!this->frameEvent || !this->freeEvent)
   {
-    DEBUG_ERROR("Failed to create the frame event");
+    DEBUG_ERROR("Failed to create the events");
+    if (this->frameEvent)
+      lgFreeEvent(this->frameEvent);
+    if (this->freeEvent)
+      lgFreeEvent(this->freeEvent);
     free(this);
     return false;
   }
 
+  this->writeFrameFn        = writeFrameFn;
+  this->getPointerBufferFn  = getPointerBufferFn;
+  this->postPointerBufferFn = postPointerBufferFn;
+
+  return true;
+}
+
+// copy the current cursor image into the pointer buffer
+static bool xcb_getCursorShape(xcb_xfixes_get_cursor_image_reply_t * img,
+    CapturePointer * pointer)
+{
+  void   * data;
+  uint32_t size;
+  if (!this->getPointerBufferFn(&data, &size))
+    return false;
+
+  // the image is premultiplied ARGB, which is BGRA in memory
+  const uint32_t pitch = img->width * 4;
+  if (pitch * img->height > size)
+  {
+    DEBUG_WARN("The cursor of %ux%u is too large", img->width, img->height);
+    return false;
+  }
+
+  memcpy(data, xcb_xfixes_get_cursor_image_cursor_image(img),
+      pitch * img->height);
+
+  pointer->shapeUpdate = true;
+  pointer->format      = CAPTURE_FMT_COLOR;
+  pointer->hx          = img->xhot;
+  pointer->hy          = img->yhot;
+  pointer->width       = img->width;
+  pointer->height      = img->height;
+  pointer->pitch       = pitch;
+  return true;
+}
+
+/* find the output the pointer is on and its position relative to it,
+ * returns false and leaves output, x & y as they were if it is not over any
+ * of the captured areas */
+static bool xcb_pointerOutput(const xcb_query_pointer_reply_t * pos,
+    unsigned int * output, int * x, int * y)
+{
+  for(unsigned int i = 0; i < this->outputCount; ++i)
+  {
+    const struct xcbOutput * out = &this->outputs[i];
+    int px, py;
+
+    // a captured window is the only output, the position is relative to it
+    if (this->window)
+    {
+      if (!pos->same_screen)
+        return false;
+      px = pos->win_x - out->originX;
+      py = pos->win_y - out->originY;
+    }
+    else if (pos->root == out->xcbScreen->root)
+    {
+      px = pos->root_x - out->originX;
+      py = pos->root_y - out->originY;
+    }
+    else
+      continue;
+
+    if (px < 0 || px >= (int)out->width || py < 0 || py >= (int)out->height)
+      continue;
+
+    *output = i;
+    *x      = px;
+    *y      = py;
+    return true;
+  }
+
+  return false;
+}
+
+static int pointerThread(void * opaque)
+{
+  xcb_connection_t * xcb = this->pointerXcb;
+  struct pollfd pfd =
+  {
+    .fd     = xcb_get_file_descriptor(xcb),
+    .events = POLLIN
+  };
+
+  bool shapeChanged = true;
+  int  hx = 0, hy = 0;
+  int  lastX = 0, lastY = 0;
+  unsigned int lastOutput = 0;
+  bool lastVisible = false;
+  bool posted      = false;
+
+  while(!atomic_load(&this->stop))
+  {
+    xcb_generic_event_t * event;
+    while((event = xcb_poll_for_event(xcb)))
+    {
+      if ((event->response_type & ~0x80) ==
+          this->pointerEvent + XCB_XFIXES_CURSOR_NOTIFY)
+        shapeChanged = true;
+      free(event);
+    }
+
+    if (xcb_connection_has_error(xcb))
+    {
+      DEBUG_ERROR("The pointer connection to the X server was lost");
+      break;
+    }
+
+    // send both requests before waiting for either reply
+    xcb_query_pointer_cookie_t posC = xcb_query_pointer(xcb, this->pointerRoot);
+    xcb_xfixes_get_cursor_image_cookie_t curC = { 0 };
+    if (shapeChanged)
+      curC = xcb_xfixes_get_cursor_image(xcb);
+
+    CapturePointer pointer = { 0 };
+    if (shapeChanged)
+    {
+      xcb_xfixes_get_cursor_image_reply_t * img =
+        xcb_xfixes_get_cursor_image_reply(xcb, curC, NULL);
+      if (img && xcb_getCursorShape(img, &pointer))
+      {
+        hx = img->xhot;
+        hy = img->yhot;
+      }
+      free(img);
+      shapeChanged = false;
+    }
+
+    xcb_query_pointer_reply_t * pos = xcb_query_pointer_reply(xcb, posC, NULL);
+    if (pos)
+    {
+      // off the captured areas it stays where it left them, hidden
+      unsigned int output = lastOutput;
+      int px = lastX + hx, py = lastY + hy;
+      const bool visible = xcb_pointerOutput(pos, &output, &px, &py);
+      free(pos);
+
+      // the position is of the top left of the shape, not the hotspot
+      const int x = px - hx;
+      const int y = py - hy;
+
+      if (!posted || pointer.shapeUpdate || output != lastOutput ||
+          x != lastX || y != lastY || visible != lastVisible)
+      {
+        pointer.positionUpdate = true;
+        pointer.output         = output;
+        pointer.x              = x;
+        pointer.y              = y;
+        pointer.visible        = visible;
+        this->postPointerBufferFn(pointer);
+
+        lastOutput  = output;
+        lastX       = x;
+        lastY       = y;
+        lastVisible = visible;
+        posted      = true;
+      }
+    }
+    else if (pointer.shapeUpdate)
+    {
+      pointer.visible = lastVisible;
+      this->postPointerBufferFn(pointer);
+    }
+
+    // wake early if the shape changes
+    if (poll(&pfd, 1, POINTER_INTERVAL) < 0 && errno != EINTR)
+    {
+      DEBUG_ERROR("poll failed: %s", strerror(errno));
+      break;
+    }
+  }
+
+  return 0;
+}
+
+static bool xcb_initPointer(void)
+{
+  this->pointerXcb = xcb_connect(NULL, NULL);
+  if (!this->pointerXcb || xcb_connection_has_error(this->pointerXcb))
+  {
+    DEBUG_ERROR("Unable to open the X display for the pointer");
+    return false;
+  }
+
+  if (!xcb_get_extension_data(this->pointerXcb, &xcb_xfixes_id)->present)
+  {
+    DEBUG_WARN("XFixes is missing, the cursor will not be captured");
+    return true;
+  }
+
+  xcb_xfixes_query_version_reply_t * ver = xcb_xfixes_query_version_reply(
+      this->pointerXcb, xcb_xfixes_query_version(this->pointerXcb, 2, 0),
+      NULL);
+  if (!ver)
+  {
+    DEBUG_WARN("Failed to query the XFixes version, the cursor will not be "
+        "captured");
+    return true;
+  }
+  free(ver);
+
+  /* the pointer is queried relative to the window if one is captured, else
+   * the reply gives the root of the screen it is on */
+  this->pointerRoot  = this->window ?
+    this->window : this->outputs[0].xcbScreen->root;
+  this->pointerEvent =
+    xcb_get_extension_data(this->pointerXcb, &xcb_xfixes_id)->first_event;
+
+  if (this->window)
+    xcb_xfixes_select_cursor_input(this->pointerXcb, this->window,
+        XCB_XFIXES_CURSOR_NOTIFY_MASK_DISPLAY_CURSOR);
+  else
+    for(unsigned int i = 0; i < this->outputCount; ++i)
+      xcb_xfixes_select_cursor_input(this->pointerXcb,
+          this->outputs[i].xcbScreen->root,
+          XCB_XFIXES_CURSOR_NOTIFY_MASK_DISPLAY_CURSOR);
+  xcb_flush(this->pointerXcb);
+
+  if (!lgCreateThread("XCBPointer", pointerThread, NULL, &this->pointerThread))
+  {
+    DEBUG_ERROR("Failed to create the pointer thread");
+    return false;
+  }
+
   return true;
 }
 
+// find the area the named RandR output shows
+static bool xcb_selectOutput(struct xcbOutput * out, const char * name)
+{
+  if (!xcb_get_extension_data(this->xcb, &xcb_randr_id)->present)
+  {
+    DEBUG_ERROR("RandR is required to select an output");
+    return false;
+  }
+
+  xcb_randr_get_screen_resources_current_reply_t * res =
+    xcb_randr_get_screen_resources_current_reply(this->xcb,
+        xcb_randr_get_screen_resources_current(this->xcb,
+          out->xcbScreen->root), NULL);
+  if (!res)
+  {
+    DEBUG_ERROR("Failed to get the RandR screen resources");
+    return false;
+  }
+
+  const xcb_randr_output_t * outputs =
+    xcb_randr_get_screen_resources_current_outputs(res);
+  const int count = xcb_randr_get_screen_resources_current_outputs_length(res);
+
+  bool found = false;
+  for(int i = 0; i < count && !found; ++i)
+  {
+    xcb_randr_get_output_info_reply_t * info = xcb_randr_get_output_info_reply(
+        this->xcb, xcb_randr_get_output_info(this->xcb, outputs[i],
+          res->config_timestamp), NULL);
+    if (!info)
+      continue;
+
+    const char * infoName = (const char *)xcb_randr_get_output_info_name(info);
+    const int    nameLen  = xcb_randr_get_output_info_name_length(info);
+    if (nameLen != strlen(name) || memcmp(infoName, name, nameLen) != 0)
+    {
+      DEBUG_INFO("Available Output : %.*s", nameLen, infoName);
+      free(info);
+      continue;
+    }
+
+    if (info->crtc == XCB_NONE)
+    {
+      DEBUG_ERROR("The output %s is not active", name);
+      free(info);
+      break;
+    }
+
+    xcb_randr_get_crtc_info_reply_t * crtc = xcb_randr_get_crtc_info_reply(
+        this->xcb, xcb_randr_get_crtc_info(this->xcb, info->crtc,
+          res->config_timestamp), NULL);
+    free(info);
+    if (!crtc)
+    {
+      DEBUG_ERROR("Failed to get the CRTC of the output %s", name);
+      break;
+    }
+
+    // the size already accounts for the rotation of the output
+    out->srcX   = out->originX = crtc->x;
+    out->srcY   = out->originY = crtc->y;
+    out->width  = crtc->width;
+    out->height = crtc->height;
+    free(crtc);
+    found = true;
+  }
+
+  free(res);
+  if (!found)
+    DEBUG_ERROR("The output %s was not found", name);
+  return found;
+}
+
+// name the pixmap Composite keeps the contents of the window in
+static bool xcb_selectWindow(struct xcbOutput * out, xcb_window_t window)
+{
+  if (!xcb_get_extension_data(this->xcb, &xcb_composite_id)->present)
+  {
+    DEBUG_ERROR("Composite is required to capture a window");
+    return false;
+  }
+
+  xcb_composite_query_version_reply_t * ver = xcb_composite_query_version_reply(
+      this->xcb, xcb_composite_query_version(this->xcb, 0, 2), NULL);
+  const bool hasName = ver && (ver->major_version > 0 ||
+      ver->minor_version >= 2);
+  free(ver);
+  if (!hasName)
+  {
+    DEBUG_ERROR("Composite 0.2 is required to capture a window");
+    return false;
+  }
+
+  xcb_get_geometry_reply_t * geom = xcb_get_geometry_reply(this->xcb,
+      xcb_get_geometry(this->xcb, window), NULL);
+  if (!geom)
+  {
+    DEBUG_ERROR("The window 0x%x was not found", window);
+    return false;
+  }
+
+  // the pixmap includes the border, the contents start inside it
+  out->srcX    = geom->border_width;
+  out->srcY    = geom->border_width;
+  out->originX = 0;
+  out->originY = 0;
+  out->width   = geom->width;
+  out->height  = geom->height;
+  free(geom);
+
+  // the window is resized or goes away, see xcb_processEvents
+  const uint32_t events = XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+  xcb_change_window_attributes(this->xcb, window, XCB_CW_EVENT_MASK, &events);
+  xcb_composite_redirect_window(this->xcb, window,
+      XCB_COMPOSITE_REDIRECT_AUTOMATIC);
+
+  const xcb_pixmap_t pixmap = xcb_generate_id(this->xcb);
+  xcb_generic_error_t * error = xcb_request_check(this->xcb,
+      xcb_composite_name_window_pixmap_checked(this->xcb, window, pixmap));
+  if (error)
+  {
+    DEBUG_ERROR("Failed to get the pixmap of the window 0x%x, is it mapped?",
+        window);
+    free(error);
+    return false;
+  }
+
+  this->window  = window;
+  out->drawable = pixmap;
+  return true;
+}
+
+/* restrict the capture to the output, region or window the user selected,
+ * returns false on failure */
+static bool xcb_selectSource(struct xcbOutput * out, bool * selected)
+{
+  const char * output = option_get_string("xcb", "output");
+  const char * region = option_get_string("xcb", "region");
+  const char * window = option_get_string("xcb", "window");
+
+  const int count =
+    (output && *output) + (region && *region) + (window && *window);
+  *selected = count > 0;
+  if (count > 1)
+  {
+    DEBUG_ERROR("Only one of xcb:output, xcb:region and xcb:window may be set");
+    return false;
+  }
+
+  if (output && *output)
+  {
+    if (!xcb_selectOutput(out, output))
+      return false;
+    DEBUG_INFO("Output           : %s", output);
+  }
+  else if (region && *region)
+  {
+    struct Rect rect;
+    xcb_parseRegion(region, &rect);
+    if (rect.x + rect.w > out->width || rect.y + rect.h > out->height)
+    {
+      DEBUG_ERROR("The region %s is outside of the %ux%u screen", region,
+          out->width, out->height);
+      return false;
+    }
+
+    out->srcX   = out->originX = rect.x;
+    out->srcY   = out->originY = rect.y;
+    out->width  = rect.w;
+    out->height = rect.h;
+  }
+  else if (window && *window)
+  {
+    xcb_window_t id = 0;
+    xcb_parseWindow(window, &id);
+    if (!xcb_selectWindow(out, id))
+      return false;
+    DEBUG_INFO("Window           : 0x%x", id);
+  }
+
+  return true;
+}
+
+static bool xcb_initBuffer(struct xcbBuffer * buf, size_t size)
+{
+  buf->seg   = xcb_generate_id(this->xcb);
+  buf->shmID = shmget(IPC_PRIVATE, size, IPC_CREAT | 0777);
+  if (buf->shmID == -1)
+  {
+    DEBUG_ERROR("shmget failed");
+    return false;
+  }
+
+  xcb_shm_attach(this->xcb, buf->seg, buf->shmID, false);
+  buf->data = shmat(buf->shmID, NULL, 0);
+  if ((uintptr_t)buf->data == -1)
+  {
+    DEBUG_ERROR("shmat failed");
+    return false;
+  }
+
+  return true;
+}
+
+static void xcb_freeBuffer(struct xcbBuffer * buf)
+{
+  if ((uintptr_t)buf->data != -1)
+  {
+    shmdt(buf->data);
+    buf->data = (void *)-1;
+  }
+
+  if (buf->shmID != -1)
+  {
+    shmctl(buf->shmID, IPC_RMID, NULL);
+    buf->shmID = -1;
+  }
+}
+
 static bool xcb_init(void)
 {
   assert(this);
   assert(!this->initialized);
 
+  atomic_store(&this->stop, false);
   lgResetEvent(this->frameEvent);
+  lgResetEvent(this->freeEvent );
+  this->window = XCB_NONE;
+  this->reinit = false;
 
   this->xcb = xcb_connect(NULL, NULL);
   if (!this->xcb || xcb_connection_has_error(this->xcb))
@@ -100,29 +929,80 @@ static bool xcb_init(void)
     goto fail;
   }
 
-  xcb_screen_iterator_t iter;
-  iter            = xcb_setup_roots_iterator(xcb_get_setup(this->xcb));
-  this->xcbScreen = iter.data;
-  this->width     = iter.data->width_in_pixels;
-  this->height    = iter.data->height_in_pixels;
-  DEBUG_INFO("Frame Size       : %u x %u", this->width, this->height);
+  this->outputCount = 0;
+  this->current     = 0;
+  this->useDamage   = option_get_bool("xcb", "damage") && xcb_initDamage();
+  this->zeroCopy    = this->shm && option_get_bool("xcb", "zeroCopy") &&
+    xcb_initZeroCopy();
+
+  // when zero copy the capture happens in getFrame, there is no overlap
+  this->bufferCount = this->zeroCopy ? 1 : option_get_int("xcb", "buffers");
 
-  this->seg   = xcb_generate_id(this->xcb);
-  this->shmID = shmget(IPC_PRIVATE, xcb_getMaxFrameSize(), IPC_CREAT | 0777);
-  if (this->shmID == -1)
+  // a selected output, region or window is on the first screen
+  bool selected = false;
+  unsigned int maxOutputs = KVMFR_MAX_OUTPUTS;
+
+  xcb_screen_iterator_t iter;
+  iter = xcb_setup_roots_iterator(xcb_get_setup(this->xcb));
+  for(; iter.rem && this->outputCount < maxOutputs; xcb_screen_next(&iter))
   {
-    DEBUG_ERROR("shmget failed");
-    goto fail;
+    struct xcbOutput * out = &this->outputs[this->outputCount++];
+    out->xcbScreen = iter.data;
+    out->drawable  = iter.data->root;
+    out->srcX      = out->originX = 0;
+    out->srcY      = out->originY = 0;
+    out->width     = iter.data->width_in_pixels;
+    out->height    = iter.data->height_in_pixels;
+    atomic_store(&out->needFull, true);
+    atomic_store(&out->head, 0);
+    atomic_store(&out->tail, 0);
+
+    if (this->outputCount == 1)
+    {
+      if (!xcb_selectSource(out, &selected))
+        goto fail;
+      if (selected)
+        maxOutputs = 1;
+    }
+
+    DEBUG_INFO("Frame Size %u     : %u x %u", this->outputCount - 1,
+        out->width, out->height);
+
+    // the damaged rectangles never overlap so they always fit in a frame
+    const size_t frameSize = out->width * out->height * 4;
+    for(unsigned int i = 0; i < this->bufferCount; ++i)
+      if (!xcb_initBuffer(&out->buffers[i], frameSize))
+        goto fail;
+
+    if (!this->useDamage)
+      continue;
+
+    if (!this->zeroCopy && !(out->image = malloc(frameSize)))
+    {
+      DEBUG_ERROR("Failed to allocate the frame");
+      goto fail;
+    }
+
+    out->damage   = xcb_generate_id(this->xcb);
+    out->region   = xcb_generate_id(this->xcb);
+    xcb_damage_create(this->xcb, out->damage,
+        this->window ? this->window : out->xcbScreen->root,
+        XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY);
+    xcb_xfixes_create_region(this->xcb, out->region, 0, NULL);
   }
 
-  xcb_shm_attach(this->xcb, this->seg ,this->shmID, false);
-  this->data = shmat(this->shmID, NULL, 0);
-  if ((uintptr_t)this->data == -1)
-  {
-    DEBUG_ERROR("shmat failed");
+  if (iter.rem && !selected)
+    DEBUG_WARN("Only the first %d X screens will be captured", KVMFR_MAX_OUTPUTS);
+
+  DEBUG_INFO("Capture Buffers  : %u", this->bufferCount);
+
+  xcb_flush(this->xcb);
+
+  this->vsync = option_get_bool("xcb", "vsync") && xcb_initVSync();
+  xcb_flush(this->xcb);
+
+  if (!xcb_initPointer())
     goto fail;
-  }
-  DEBUG_INFO("Frame Data       : 0x%" PRIXPTR, (uintptr_t)this->data);
 
   this->initialized = true;
   return true;
@@ -131,20 +1011,38 @@ fail:
   return false;
 }
 
+static void xcb_stop(void)
+{
+  atomic_store(&this->stop, true);
+  lgSignalEvent(this->frameEvent);
+  lgSignalEvent(this->freeEvent );
+}
+
 static bool xcb_deinit(void)
 {
   assert(this);
 
-  if ((uintptr_t)this->data != -1)
+  if (this->pointerThread)
   {
-    shmdt(this->data);
-    this->data = (void *)-1;
+    atomic_store(&this->stop, true);
+    lgJoinThread(this->pointerThread, NULL);
+    this->pointerThread = NULL;
   }
 
-  if (this->shmID != -1)
+  if (this->pointerXcb)
   {
-    shmctl(this->shmID, IPC_RMID, NULL);
-    this->shmID = -1;
+    xcb_disconnect(this->pointerXcb);
+    this->pointerXcb = NULL;
+  }
+
+  for(int i = 0; i < KVMFR_MAX_OUTPUTS; ++i)
+  {
+    struct xcbOutput * out = &this->outputs[i];
+    for(int j = 0; j < MAX_BUFFERS; ++j)
+      xcb_freeBuffer(&out->buffers[j]);
+
+    free(out->image);
+    out->image = NULL;
   }
 
   if (this->xcb)
@@ -153,20 +1051,35 @@ static bool xcb_deinit(void)
     this->xcb = NULL;
   }
 
+  this->zeroCopy    = false;
+  this->vsync       = false;
   this->initialized = false;
-  return false;
+  return true;
 }
 
 static void xcb_free(void)
 {
   lgFreeEvent(this->frameEvent);
+  lgFreeEvent(this->freeEvent );
   free(this);
   this = NULL;
 }
 
 static unsigned int xcb_getMaxFrameSize(void)
 {
-  return this->width * this->height * 4;
+  unsigned int size = 0;
+  for(unsigned int i = 0; i < this->outputCount; ++i)
+  {
+    const unsigned int s = this->outputs[i].width * this->outputs[i].height * 4;
+    if (s > size)
+      size = s;
+  }
+  return size;
+}
+
+static unsigned int xcb_getOutputCount(void)
+{
+  return this->outputCount;
 }
 
 static unsigned int xcb_getMouseScale(void)
@@ -174,41 +1087,436 @@ static unsigned int xcb_getMouseScale(void)
   return 100;
 }
 
-static CaptureResult xcb_capture(void)
+// mark the outputs that XDamage reports have changed, optionally waiting
+static bool xcb_processEvents(unsigned int timeout)
 {
-  assert(this);
-  assert(this->initialized);
+  if (timeout)
+  {
+    struct pollfd pfd =
+    {
+      .fd     = xcb_get_file_descriptor(this->xcb),
+      .events = POLLIN
+    };
+
+    if (poll(&pfd, 1, timeout) < 0 && errno != EINTR)
+    {
+      DEBUG_ERROR("poll failed: %s", strerror(errno));
+      return false;
+    }
+  }
+
+  xcb_generic_event_t * event;
+  while((event = xcb_poll_for_event(this->xcb)))
+  {
+    if ((event->response_type & ~0x80) == XCB_GE_GENERIC)
+    {
+      const xcb_ge_generic_event_t * ge = (const xcb_ge_generic_event_t *)event;
+      if (this->vsync && ge->extension == this->presentOpcode &&
+          ge->event_type == XCB_PRESENT_EVENT_COMPLETE_NOTIFY)
+        xcb_onVBlank((const xcb_present_complete_notify_event_t *)event);
+    }
+    else if (this->useDamage &&
+        (event->response_type & ~0x80) == this->damageEvent + XCB_DAMAGE_NOTIFY)
+    {
+      const xcb_damage_notify_event_t * notify =
+        (const xcb_damage_notify_event_t *)event;
+
+      for(unsigned int i = 0; i < this->outputCount; ++i)
+        if (this->outputs[i].damage == notify->damage)
+          this->outputs[i].damaged = true;
+    }
+    else if ((event->response_type & ~0x80) == XCB_CONFIGURE_NOTIFY)
+    {
+      // the pixmap of a resized window is replaced
+      const xcb_configure_notify_event_t * notify =
+        (const xcb_configure_notify_event_t *)event;
+      if (notify->window == this->window &&
+          (notify->width  != this->outputs[0].width ||
+           notify->height != this->outputs[0].height))
+        this->reinit = true;
+    }
+    else if ((event->response_type & ~0x80) == XCB_UNMAP_NOTIFY ||
+             (event->response_type & ~0x80) == XCB_DESTROY_NOTIFY)
+      this->reinit = true;
+
+    free(event);
+  }
+
+  if (this->vsync)
+    xcb_flush(this->xcb);
+
+  if (xcb_connection_has_error(this->xcb))
+  {
+    DEBUG_ERROR("The connection to the X server was lost");
+    return false;
+  }
 
-  if (!this->hasFrame)
+  return true;
+}
+
+// wait for the next vblank, collecting damage in the meantime
+static bool xcb_waitVBlank(void)
+{
+  const uint64_t end = microtime() + DAMAGE_TIMEOUT * 1000;
+  while(!this->vblank && !this->reinit)
   {
-    this->imgC = xcb_shm_get_image_unchecked(
+    const uint64_t now = microtime();
+    if (now >= end)
+      break;
+
+    if (!xcb_processEvents((end - now + 999) / 1000))
+      return false;
+  }
+  return true;
+}
+
+static inline bool xcb_bufferFree(struct xcbOutput * out)
+{
+  return atomic_load_explicit(&out->head, memory_order_relaxed) -
+    atomic_load_explicit(&out->tail, memory_order_acquire) < this->bufferCount;
+}
+
+static bool xcb_hasDamage(void)
+{
+  for(unsigned int i = 0; i < this->outputCount; ++i)
+  {
+    struct xcbOutput * out = &this->outputs[i];
+    if (xcb_bufferFree(out) && (out->damaged || atomic_load(&out->needFull)))
+      return true;
+  }
+  return false;
+}
+
+// true if an output has damage but no buffer to capture it into
+static bool xcb_damageBlocked(void)
+{
+  for(unsigned int i = 0; i < this->outputCount; ++i)
+  {
+    struct xcbOutput * out = &this->outputs[i];
+    if (!xcb_bufferFree(out) && (out->damaged || atomic_load(&out->needFull)))
+      return true;
+  }
+  return false;
+}
+
+static bool xcb_anyBufferFree(void)
+{
+  for(unsigned int i = 0; i < this->outputCount; ++i)
+    if (xcb_bufferFree(&this->outputs[i]))
+      return true;
+  return false;
+}
+
+/* wait a little for damage that can be captured. Damage is only notified once
+ * until it is subtracted, so while it waits for a buffer the X server has
+ * nothing more to tell us about it. Wait for the frame thread to release a
+ * buffer instead, checking the X server for the other outputs every 1ms. */
+static bool xcb_waitDamage(void)
+{
+  const uint64_t end = microtime() + DAMAGE_TIMEOUT * 1000;
+  while(!this->reinit && !xcb_hasDamage() && !atomic_load(&this->stop))
+  {
+    const uint64_t now = microtime();
+    if (now >= end)
+      break;
+
+    if (xcb_damageBlocked())
+    {
+      lgWaitEvent(this->freeEvent, 1);
+      if (!xcb_processEvents(0))
+        return false;
+    }
+    else if (!xcb_processEvents((end - now + 999) / 1000))
+      return false;
+  }
+  return true;
+}
+
+/* fetch the damage accumulated since the last capture and request just those
+ * rectangles, returns false if there is nothing to capture */
+static bool xcb_requestRects(struct xcbOutput * out, struct xcbBuffer * buf)
+{
+  xcb_damage_subtract(this->xcb, out->damage, XCB_NONE, out->region);
+  xcb_xfixes_fetch_region_reply_t * reply = xcb_xfixes_fetch_region_reply(
+      this->xcb, xcb_xfixes_fetch_region(this->xcb, out->region), NULL);
+  if (!reply)
+  {
+    atomic_store(&out->needFull, true);
+    return true;
+  }
+
+  const xcb_rectangle_t * xr = xcb_xfixes_fetch_region_rectangles(reply);
+  const int count            = xcb_xfixes_fetch_region_rectangles_length(reply);
+
+  // too many to describe to the client, capture everything instead
+  if (count > KVMFR_MAX_DAMAGE_RECTS)
+  {
+    free(reply);
+    atomic_store(&out->needFull, true);
+    return true;
+  }
+
+  // the region is banded so the rectangles never overlap and always fit
+  unsigned int offset = 0;
+  for(int i = 0; i < count; ++i)
+  {
+    const int rx = xr[i].x - out->originX;
+    const int ry = xr[i].y - out->originY;
+    const int x1 = rx < 0 ? 0 : rx;
+    const int y1 = ry < 0 ? 0 : ry;
+    int x2 = rx + xr[i].width;
+    int y2 = ry + xr[i].height;
+    if (x2 > (int)out->width ) x2 = out->width;
+    if (y2 > (int)out->height) y2 = out->height;
+    if (x2 <= x1 || y2 <= y1)
+      continue;
+
+    const unsigned int n = buf->rectCount++;
+    FrameDamageRect * rect = &buf->rects[n];
+    rect->x      = x1;
+    rect->y      = y1;
+    rect->width  = x2 - x1;
+    rect->height = y2 - y1;
+
+    // when zero copy the damage is reported but the frame is captured in full
+    if (this->zeroCopy)
+      continue;
+
+    buf->rectOffset[n] = offset;
+    buf->rectC     [n] = xcb_shm_get_image_unchecked(
         this->xcb,
-        this->xcbScreen->root,
-        0, 0,
-        this->width,
-        this->height,
+        out->drawable,
+        out->srcX + rect->x,
+        out->srcY + rect->y,
+        rect->width,
+        rect->height,
         ~0,
         XCB_IMAGE_FORMAT_Z_PIXMAP,
-        this->seg,
-        0);
+        buf->seg,
+        offset);
+
+    offset += rect->width * rect->height * 4;
+  }
+
+  free(reply);
+  return buf->rectCount > 0;
+}
+
+static bool xcb_requestFrame(struct xcbOutput * out, struct xcbBuffer * buf)
+{
+  out->damaged   = false;
+  buf->full      = false;
+  buf->rectCount = 0;
+
+  if (this->useDamage)
+  {
+    if (!atomic_load(&out->needFull) && !xcb_requestRects(out, buf))
+      return false;
+
+    if (!atomic_load(&out->needFull))
+      return true;
 
-    this->hasFrame  = true;
-    lgSignalEvent(this->frameEvent);
+    // discard the damage, it is all about to be captured
+    xcb_damage_subtract(this->xcb, out->damage, XCB_NONE, XCB_NONE);
   }
 
+  buf->full          = true;
+  buf->rectCount     = 1;
+  buf->rectOffset[0] = 0;
+  buf->rects[0]      = (FrameDamageRect)
+  {
+    .x      = 0,
+    .y      = 0,
+    .width  = out->width,
+    .height = out->height
+  };
+  atomic_store(&out->needFull, false);
+
+  // the destination is not known until getFrame
+  if (this->zeroCopy)
+    return true;
+
+  buf->rectC[0] = xcb_shm_get_image_unchecked(
+      this->xcb,
+      out->drawable,
+      out->srcX, out->srcY,
+      out->width,
+      out->height,
+      ~0,
+      XCB_IMAGE_FORMAT_Z_PIXMAP,
+      buf->seg,
+      0);
+
+  return true;
+}
+
+static CaptureResult xcb_capture(void)
+{
+  assert(this);
+  assert(this->initialized);
+
+  // wait for the frame thread to release a buffer rather than spinning
+  if (!this->useDamage)
+    while(!xcb_anyBufferFree())
+    {
+      if (atomic_load(&this->stop) ||
+          !lgWaitEvent(this->freeEvent, DAMAGE_TIMEOUT))
+        return CAPTURE_RESULT_TIMEOUT;
+    }
+
+  if (this->useDamage || this->window || this->vsync)
+  {
+    if (!xcb_processEvents(0))
+      return CAPTURE_RESULT_ERROR;
+
+    if (this->vsync)
+    {
+      if (!xcb_waitVBlank())
+        return CAPTURE_RESULT_ERROR;
+
+      if (!this->vblank && !this->reinit)
+        return CAPTURE_RESULT_TIMEOUT;
+      this->vblank = false;
+    }
+    // if nothing changed wait a little for damage before reporting a timeout
+    else if (this->useDamage && !xcb_waitDamage())
+      return CAPTURE_RESULT_ERROR;
+
+    if (this->reinit)
+    {
+      DEBUG_INFO("The captured window was resized or unmapped");
+      return CAPTURE_RESULT_REINIT;
+    }
+
+    if (this->useDamage && !xcb_hasDamage())
+      return CAPTURE_RESULT_TIMEOUT;
+  }
+
+  bool requested = false;
+  for(unsigned int i = 0; i < this->outputCount; ++i)
+  {
+    struct xcbOutput * out = &this->outputs[i];
+    if (!xcb_bufferFree(out))
+      continue;
+
+    if (this->useDamage && !out->damaged && !atomic_load(&out->needFull))
+      continue;
+
+    const unsigned int head =
+      atomic_load_explicit(&out->head, memory_order_relaxed);
+    if (!xcb_requestFrame(out, &out->buffers[head % this->bufferCount]))
+      continue;
+
+    atomic_store_explicit(&out->head, head + 1, memory_order_release);
+    requested = true;
+  }
+
+  if (!requested)
+    return CAPTURE_RESULT_TIMEOUT;
+
+  xcb_flush(this->xcb);
+  lgSignalEvent(this->frameEvent);
   return CAPTURE_RESULT_OK;
 }
 
+// the oldest capture of the output, which is copied next
+static inline struct xcbBuffer * xcb_tailBuffer(struct xcbOutput * out)
+{
+  return &out->buffers[atomic_load_explicit(&out->tail, memory_order_relaxed) %
+    this->bufferCount];
+}
+
+// hand the buffer back to capture once its data has been copied
+static inline void xcb_releaseBuffer(struct xcbOutput * out)
+{
+  atomic_fetch_add_explicit(&out->tail, 1, memory_order_release);
+  lgSignalEvent(this->freeEvent);
+}
+
 static CaptureResult xcb_waitFrame(CaptureFrame * frame)
 {
-  lgWaitEvent(this->frameEvent, TIMEOUT_INFINITE);
+  // hand out the pending outputs in turn so that none can starve the others
+  struct xcbOutput * out = NULL;
+  while(!out)
+  {
+    for(unsigned int i = 1; i <= this->outputCount; ++i)
+    {
+      const unsigned int index = (this->current + i) % this->outputCount;
+      struct xcbOutput * o = &this->outputs[index];
+      if (atomic_load_explicit(&o->head, memory_order_acquire) !=
+          atomic_load_explicit(&o->tail, memory_order_relaxed))
+      {
+        this->current = index;
+        out           = o;
+        break;
+      }
+    }
 
-  frame->width    = this->width;
-  frame->height   = this->height;
-  frame->pitch    = this->width * 4;
-  frame->stride   = this->width;
+    if (!out)
+    {
+      if (atomic_load(&this->stop))
+        return CAPTURE_RESULT_TIMEOUT;
+      lgWaitEvent(this->frameEvent, TIMEOUT_INFINITE);
+    }
+  }
+
+  frame->output   = this->current;
+  frame->width    = out->width;
+  frame->height   = out->height;
+  frame->pitch    = out->width * 4;
+  frame->stride   = out->width;
   frame->format   = CAPTURE_FMT_BGRA;
   frame->rotation = CAPTURE_ROT_0;
+  frame->interval = this->vsync ? this->frameInterval : 0;
+
+  const struct xcbBuffer * buf = xcb_tailBuffer(out);
+  frame->damageRectsCount = buf->full ? 0 : buf->rectCount;
+  memcpy(frame->damageRects, buf->rects,
+      frame->damageRectsCount * sizeof(FrameDamageRect));
+
+  return CAPTURE_RESULT_OK;
+}
+
+/* capture the full frame into the framebuffer if it is in the shared memory,
+ * otherwise into the segment of the output and copy it */
+static CaptureResult xcb_getFrameDirect(struct xcbOutput * out,
+    struct xcbBuffer * buf, FrameBuffer * frame)
+{
+  const size_t size = out->width * out->height * 4;
+  uint8_t * shmMem  = (uint8_t *)this->shm->mem;
+  uint8_t * dst     = (uint8_t *)framebuffer_get_buffer(frame);
+  const bool direct = dst >= shmMem && dst + size <= shmMem + this->shm->size;
+
+  xcb_shm_get_image_reply_t * img = xcb_shm_get_image_reply(this->xcb,
+      xcb_shm_get_image_unchecked(
+        this->xcb,
+        out->drawable,
+        out->srcX, out->srcY,
+        out->width,
+        out->height,
+        ~0,
+        XCB_IMAGE_FORMAT_Z_PIXMAP,
+        direct ? this->shmSeg : buf->seg,
+        direct ? dst - shmMem : 0),
+      NULL);
+
+  if (!img)
+  {
+    DEBUG_ERROR("Failed to get image reply");
+    atomic_store(&out->needFull, true);
+    xcb_releaseBuffer(out);
+    return CAPTURE_RESULT_ERROR;
+  }
+  free(img);
+
+  /* when zero copy the capture thread never writes into the segment, so the
+   * buffer can be released before it is copied out */
+  xcb_releaseBuffer(out);
+
+  if (direct)
+    framebuffer_set_write_ptr(frame, size);
+  else
+    this->writeFrameFn(frame, buf->data, size);
 
   return CAPTURE_RESULT_OK;
 }
@@ -218,18 +1526,60 @@ static CaptureResult xcb_getFrame(FrameBuffer * frame)
   assert(this);
   assert(this->initialized);
 
-  xcb_shm_get_image_reply_t * img;
-  img = xcb_shm_get_image_reply(this->xcb, this->imgC, NULL);
-  if (!img)
+  struct xcbOutput * out = &this->outputs[this->current];
+  struct xcbBuffer * buf = xcb_tailBuffer(out);
+  const unsigned int pitch = out->width * 4;
+
+  if (this->zeroCopy)
+    return xcb_getFrameDirect(out, buf, frame);
+
+  // every reply must be collected, even if one of them failed
+  bool ok = true;
+  for(unsigned int i = 0; i < buf->rectCount; ++i)
+  {
+    xcb_shm_get_image_reply_t * img;
+    img = xcb_shm_get_image_reply(this->xcb, buf->rectC[i], NULL);
+    if (!img)
+      ok = false;
+    free(img);
+  }
+
+  if (!ok)
   {
     DEBUG_ERROR("Failed to get image reply");
+    atomic_store(&out->needFull, true);
+    xcb_releaseBuffer(out);
     return CAPTURE_RESULT_ERROR;
   }
 
-  framebuffer_write(frame, this->data, this->width * this->height * 4);
-  free(img);
+  // without damage every capture is a full frame
+  if (!this->useDamage)
+  {
+    this->writeFrameFn(frame, buf->data, pitch * out->height);
+    xcb_releaseBuffer(out);
+    return CAPTURE_RESULT_OK;
+  }
+
+  // merge the rectangles into the frame
+  for(unsigned int i = 0; i < buf->rectCount; ++i)
+  {
+    const FrameDamageRect * rect = &buf->rects[i];
+    const unsigned int rectPitch = rect->width * 4;
+    const uint8_t * src = (uint8_t *)buf->data + buf->rectOffset[i];
+    uint8_t       * dst = out->image + rect->y * pitch + rect->x * 4;
+
+    for(unsigned int y = 0; y < rect->height; ++y)
+    {
+      memcpy(dst, src, rectPitch);
+      src += rectPitch;
+      dst += pitch;
+    }
+  }
+
+  // the segment can be captured into again while the frame is written
+  xcb_releaseBuffer(out);
+  this->writeFrameFn(frame, out->image, pitch * out->height);
 
-  this->hasFrame = false;
   return CAPTURE_RESULT_OK;
 }
 
@@ -237,12 +1587,16 @@ struct CaptureInterface Capture_XCB =
 {
   .shortName       = "XCB",
   .getName         = xcb_getName,
+  .initOptions     = xcb_initOptions,
+  .setSharedMemory = xcb_setSharedMemory,
   .create          = xcb_create,
   .init            = xcb_init,
+  .stop            = xcb_stop,
   .deinit          = xcb_deinit,
   .free            = xcb_free,
   .getMaxFrameSize = xcb_getMaxFrameSize,
   .getMouseScale   = xcb_getMouseScale,
+  .getOutputCount  = xcb_getOutputCount,
   .capture         = xcb_capture,
   .waitFrame       = xcb_waitFrame,
   .getFrame        = xcb_getFrame
@@ -29,6 +29,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <assert.h>
 #include <stdatomic.h>
 #include <unistd.h>
+#include <string.h>
 #include <dxgi.h>
 #include <d3d11.h>
 #include <d3dcommon.h>
@@ -62,6 +63,8 @@ typedef struct Texture
   volatile enum TextureState state;
   ID3D11Texture2D          * tex;
   D3D11_MAPPED_SUBRESOURCE   map;
+  unsigned int               damageRectsCount;
+  FrameDamageRect            damageRects[KVMFR_MAX_DAMAGE_RECTS];
 }
 Texture;
 
@@ -91,6 +94,7 @@ struct iface
 
   CaptureGetPointerBuffer    getPointerBufferFn;
   CapturePostPointerBuffer   postPointerBufferFn;
+  CaptureWriteFrame          writeFrameFn;
   LGEvent                  * frameEvent;
 
   unsigned int    formatVer;
@@ -104,6 +108,13 @@ struct iface
 
   int  lastPointerX, lastPointerY;
   bool lastPointerVisible;
+
+  // damage accumulated since the last frame that was copied
+  bool                   damageFull;
+  unsigned int           damageRectsCount;
+  FrameDamageRect        damageRects[KVMFR_MAX_DAMAGE_RECTS];
+  DXGI_OUTDUPL_MOVE_RECT moveRects   [KVMFR_MAX_DAMAGE_RECTS];
+  RECT                   dirtyRects  [KVMFR_MAX_DAMAGE_RECTS];
 };
 
 static struct iface * this    = NULL;
@@ -158,7 +169,7 @@ static void dxgi_initOptions(void)
   option_register(options);
 }
 
-static bool dxgi_create(CaptureGetPointerBuffer getPointerBufferFn, CapturePostPointerBuffer postPointerBufferFn)
+static bool dxgi_create(CaptureGetPointerBuffer getPointerBufferFn, CapturePostPointerBuffer postPointerBufferFn, CaptureWriteFrame writeFrameFn)
 {
   assert(!this);
   this = calloc(sizeof(struct iface), 1);
@@ -184,6 +195,7 @@ static bool dxgi_create(CaptureGetPointerBuffer getPointerBufferFn, CapturePostP
   this->texture             = calloc(sizeof(struct Texture), this->maxTextures);
   this->getPointerBufferFn  = getPointerBufferFn;
   this->postPointerBufferFn = postPointerBufferFn;
+  this->writeFrameFn        = writeFrameFn;
   return true;
 }
 
@@ -412,6 +424,7 @@ static bool dxgi_init(void)
 
   this->dpi = monitor_dpi(outputDesc.Monitor);
   ++this->formatVer;
+  this->damageFull = true;
 
   DEBUG_INFO("Device Descripion: %ls"    , adapterDesc.Description);
   DEBUG_INFO("Device Vendor ID : 0x%x"   , adapterDesc.VendorId);
@@ -738,6 +751,65 @@ static CaptureResult dxgi_hResultToCaptureResult(const HRESULT status)
   }
 }
 
+static void dxgi_addDamage(const RECT * rect)
+{
+  if (this->damageFull)
+    return;
+
+  if (this->damageRectsCount == KVMFR_MAX_DAMAGE_RECTS)
+  {
+    this->damageFull = true;
+    return;
+  }
+
+  FrameDamageRect * dr = &this->damageRects[this->damageRectsCount++];
+  dr->x      = rect->left;
+  dr->y      = rect->top;
+  dr->width  = rect->right  - rect->left;
+  dr->height = rect->bottom - rect->top;
+}
+
+static void dxgi_collectDamage(const DXGI_OUTDUPL_FRAME_INFO * frameInfo)
+{
+  // the rects are in desktop space, only use them if that matches the texture
+  if (this->damageFull || this->rotation != CAPTURE_ROT_0 ||
+      frameInfo->TotalMetadataBufferSize == 0)
+  {
+    this->damageFull = true;
+    return;
+  }
+
+  HRESULT status;
+  UINT    size;
+
+  status = IDXGIOutputDuplication_GetFrameMoveRects(this->dup,
+      sizeof(this->moveRects), this->moveRects, &size);
+  if (FAILED(status))
+  {
+    if (status != DXGI_ERROR_MORE_DATA)
+      DEBUG_WINERROR("GetFrameMoveRects failed", status);
+    this->damageFull = true;
+    return;
+  }
+
+  // only the destination of a move changes
+  for(UINT i = 0; i < size / sizeof(*this->moveRects); ++i)
+    dxgi_addDamage(&this->moveRects[i].DestinationRect);
+
+  status = IDXGIOutputDuplication_GetFrameDirtyRects(this->dup,
+      sizeof(this->dirtyRects), this->dirtyRects, &size);
+  if (FAILED(status))
+  {
+    if (status != DXGI_ERROR_MORE_DATA)
+      DEBUG_WINERROR("GetFrameDirtyRects failed", status);
+    this->damageFull = true;
+    return;
+  }
+
+  for(UINT i = 0; i < size / sizeof(*this->dirtyRects); ++i)
+    dxgi_addDamage(&this->dirtyRects[i]);
+}
+
 static CaptureResult dxgi_capture(void)
 {
   assert(this);
@@ -784,6 +856,9 @@ static CaptureResult dxgi_capture(void)
 
   if (frameInfo.LastPresentTime.QuadPart != 0)
   {
+    // accumulate the damage even if this frame gets skipped
+    dxgi_collectDamage(&frameInfo);
+
     tex = &this->texture[this->texWIndex];
 
     // check if the texture is free, if not skip the frame to keep up
@@ -841,6 +916,18 @@ static CaptureResult dxgi_capture(void)
       // set the state, and signal
       tex->state     = TEXTURE_STATE_PENDING_MAP;
       tex->formatVer = this->formatVer;
+
+      if (this->damageFull)
+        tex->damageRectsCount = 0;
+      else
+      {
+        tex->damageRectsCount = this->damageRectsCount;
+        memcpy(tex->damageRects, this->damageRects,
+            this->damageRectsCount * sizeof(FrameDamageRect));
+      }
+      this->damageFull       = false;
+      this->damageRectsCount = 0;
+
       if (atomic_fetch_add_explicit(&this->texReady, 1, memory_order_relaxed) == 0)
         lgSignalEvent(this->frameEvent);
 
@@ -967,6 +1054,10 @@ static CaptureResult dxgi_waitFrame(CaptureFrame * frame)
   frame->format    = this->format;
   frame->rotation  = this->rotation;
 
+  frame->damageRectsCount = tex->damageRectsCount;
+  memcpy(frame->damageRects, tex->damageRects,
+      tex->damageRectsCount * sizeof(FrameDamageRect));
+
   atomic_fetch_sub_explicit(&this->texReady, 1, memory_order_release);
   return CAPTURE_RESULT_OK;
 }
@@ -978,7 +1069,7 @@ static CaptureResult dxgi_getFrame(FrameBuffer * frame)
 
   Texture * tex = &this->texture[this->texRIndex];
 
-  framebuffer_write(frame, tex->map.pData, this->pitch * this->height);
+  this->writeFrameFn(frame, tex->map.pData, this->pitch * this->height);
   LOCKED({ID3D11DeviceContext_Unmap(this->deviceContext, (ID3D11Resource*)tex->tex, 0);});
   tex->state = TEXTURE_STATE_UNUSED;
 
@@ -42,6 +42,7 @@ struct iface
   bool                       seperateCursor;
   CaptureGetPointerBuffer    getPointerBufferFn;
   CapturePostPointerBuffer   postPointerBufferFn;
+  CaptureWriteFrame          writeFrameFn;
   LGThread                 * pointerThread;
 
   unsigned int maxWidth , maxHeight;
@@ -119,7 +120,8 @@ static void nvfbc_initOptions(void)
 
 static bool nvfbc_create(
     CaptureGetPointerBuffer  getPointerBufferFn,
-    CapturePostPointerBuffer postPointerBufferFn)
+    CapturePostPointerBuffer postPointerBufferFn,
+    CaptureWriteFrame        writeFrameFn)
 {
   if (!NvFBCInit())
     return false;
@@ -136,6 +138,7 @@ static bool nvfbc_create(
   this->seperateCursor      = option_get_bool("nvfbc", "decoupleCursor");
   this->getPointerBufferFn  = getPointerBufferFn;
   this->postPointerBufferFn = postPointerBufferFn;
+  this->writeFrameFn        = writeFrameFn;
 
   return true;
 }
@@ -363,7 +366,7 @@ static CaptureResult nvfbc_waitFrame(CaptureFrame * frame)
 
 static CaptureResult nvfbc_getFrame(FrameBuffer * frame)
 {
-  framebuffer_write(
+  this->writeFrameFn(
     frame,
     this->frameBuffer,
     this->grabInfo.dwHeight * this->grabInfo.dwBufferWidth * 4
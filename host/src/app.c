@@ -20,6 +20,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "interface/platform.h"
 #include "interface/capture.h"
 #include "dynamic/capture.h"
+#include "record.h"
 #include "common/version.h"
 #include "common/debug.h"
 #include "common/option.h"
@@ -31,6 +32,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "common/sysinfo.h"
 #include "common/time.h"
 #include "common/stringutils.h"
+#include "common/event.h"
 
 #include <lgmp/host.h>
 
@@ -43,6 +45,14 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #define CONFIG_FILE "looking-glass-host.ini"
 #define POINTER_SHAPE_BUFFERS 3
+#define POINTER_SHAPE_CACHE   4 // recently used shapes kept for reposting
+#define STAGED_FRAMES         2 // frames buffered between the pipeline stages
+
+// bounds of the adaptive spin before sleeping while waiting for queue space
+#define QUEUE_SPIN_MIN 10   // us
+#define QUEUE_SPIN_MAX 2000 // us
+
+#define FRAME_BLOCK_SIZE 1048576 // 1MiB
 
 #define ALIGN_DN(x) ((uintptr_t)(x) & ~0x7F)
 #define ALIGN_UP(x) ALIGN_DN(x + 0x7F)
@@ -71,6 +81,68 @@ enum AppState
   APP_STATE_SHUTDOWN
 };
 
+struct Output
+{
+  PLGMPHostQueue frameQueue;
+  unsigned int   queueDepth;
+  PLGMPMemory    frameMemory[LGMP_Q_FRAME_LEN];
+  unsigned int   frameIndex;
+  bool           frameValid;
+  bool           damageLost;
+  unsigned int   formatVer;
+  unsigned int   captureFormatVer;
+  bool           compressed;
+  uint32_t       frameSerial;
+
+  // the hash of the last frame posted, for duplicate suppression
+  uint64_t       frameHash;
+  unsigned int   frameHashVer;
+};
+
+// how a frame is to be stored in the shared memory
+struct FrameWrite
+{
+  FrameType        type;
+  FrameCompression compression;
+  CaptureFormat    format;
+  unsigned int     width;
+  unsigned int     height;
+  unsigned int     srcPitch;
+  unsigned int     pitch;
+};
+
+/* the state of a thread waiting for frame queue space, the time spent
+ * waiting is accumulated for the statistics */
+struct QueueWait
+{
+  unsigned int spinLimit; // us
+  uint64_t     count;
+  uint64_t     spinTime;  // us
+  uint64_t     sleepTime; // us
+};
+
+/* paces the calls to capture, backing off while the frames are unchanged and
+ * returning to full rate on activity */
+struct Governor
+{
+  unsigned int minInterval;  // us, the interval at the maximum rate
+  unsigned int idleInterval; // us, the interval when idle, zero if disabled
+  unsigned int interval;     // us, the current interval
+  uint64_t     last;         // when the last capture started
+  uint64_t     start;        // when the statistics were reset
+  uint64_t     waited;       // us spent waiting instead of capturing
+  uint64_t     captures;
+};
+
+// a frame captured into local memory waiting to be copied out
+struct StagedFrame
+{
+  FrameBuffer * fb;
+  CaptureFrame  frame;
+  uint64_t      captureTime;
+  uint64_t      hash; // only valid if dedupe is enabled
+};
+
 struct app
 {
   int exitcode;
@@ -81,24 +153,100 @@ struct app
   PLGMPMemory    pointerMemory[POINTER_SHAPE_BUFFERS];
   LG_Lock        pointerLock;
   CapturePointer pointerInfo;
-  PLGMPMemory    pointerShape;
+  struct
+  {
+    PLGMPMemory  mem;
+    uint64_t     id;      // zero if the entry is unused
+    unsigned int lastUse;
+  }
+  pointerShapes[POINTER_SHAPE_CACHE];
+  unsigned int   pointerShape;    // the index of the current shape
+  unsigned int   pointerShapeUse;
   bool           pointerShapeValid;
+  bool           pointerPosValid;
   unsigned int   pointerIndex;
-
-  size_t         maxFrameSize;
-  PLGMPHostQueue frameQueue;
-  PLGMPMemory    frameMemory[LGMP_Q_FRAME_LEN];
-  unsigned int   frameIndex;
+  KVMFRCursorPos * cursorPos;
+  KVMFRStats     * stats;
+
+  PLGMPMemory  * frameBlocks;
+  unsigned int   frameBlockCount;
+  unsigned int   frameBlocksPerFrame;
+  unsigned int   outputCount;
+  struct Output  outputs[KVMFR_MAX_OUTPUTS];
+
+  // how the frame being written by getFrame is to be stored
+  bool              compress;
+  bool              nv12;
+  struct FrameWrite write;
+
+  // the frame being written by getFrame, for app:record
+  const CaptureFrame * recordFrame;
+
+  /* when pipelined the capture stage (frameThread) writes frames into local
+   * memory and the copy stage (copyThread) moves them to the shared memory,
+   * so the copy does not hold up the capture of the next frame */
+  bool               pipeline;
+  struct StagedFrame staged[STAGED_FRAMES];
+  size_t             stagedSize;
+  atomic_uint        stagedWrite;
+  atomic_uint        stagedRead;
+  LGEvent          * stagedReady;
+  LGEvent          * stagedFree;
+
+  /* identical frames are not posted, the frames are hashed as they are
+   * staged so this requires the pipeline */
+  bool               dedupe;
+  uint64_t           stagedHash; // the hash of the frame written by getFrame
+  atomic_bool        lastFrameDup;
+  atomic_uint_fast64_t dupFrames;
+
+  // signalled by the LGMP timer each time the queues have been processed
+  LGEvent          * queueEvent;
+  LGEvent          * subsEvent;
+  struct QueueWait   frameWait;  // for room in any queue, by frameThread
+  struct QueueWait   outputWait; // for room in the queue of an output
+
+  struct Governor    governor;
+  LGEvent          * activityEvent;
 
   CaptureInterface * iface;
 
   enum AppState state;
   LGTimer  * lgmpTimer;
   LGThread * frameThread;
+  LGThread * copyThread;
 };
 
 static struct app app;
 
+static bool validateFPS(struct Option * opt, const char ** error)
+{
+  if (opt->value.x_int >= 0 && opt->value.x_int <= 1000)
+    return true;
+
+  *error = "Invalid frame rate, valid values are 0 (disabled) to 1000";
+  return false;
+}
+
+static bool validateQueueDepth(struct Option * opt, const char ** error)
+{
+  if (opt->value.x_int == 0 ||
+      (opt->value.x_int >= 2 && opt->value.x_int <= LGMP_Q_FRAME_LEN))
+    return true;
+
+  *error = "Invalid queue depth, valid values are 0 (auto) and 2 to 4";
+  return false;
+}
+
+static bool validateWriteThreads(struct Option * opt, const char ** error)
+{
+  if (opt->value.x_int >= 1 && opt->value.x_int <= 16)
+    return true;
+
+  *error = "Invalid number of write threads, valid values are 1 to 16";
+  return false;
+}
+
 static bool validateCaptureBackend(struct Option * opt, const char ** error)
 {
   if (!*opt->value.x_string)
@@ -121,9 +269,84 @@ static struct Option options[] =
     .value.x_string = "",
     .validator      = validateCaptureBackend,
   },
+  {
+    .module         = "app",
+    .name           = "queueDepth",
+    .description    = "The number of frames to buffer, 2 for the lowest latency, more for smoother pacing (0 = as many as will fit)",
+    .type           = OPTION_TYPE_INT,
+    .value.x_int    = 0,
+    .validator      = validateQueueDepth,
+  },
+  {
+    .module         = "app",
+    .name           = "compress",
+    .description    = "Losslessly compress 32bpp frames to reduce the shared memory bandwidth and size needed, at the cost of CPU time",
+    .type           = OPTION_TYPE_BOOL,
+    .value.x_bool   = false,
+  },
+  {
+    .module         = "app",
+    .name           = "nv12",
+    .description    = "Convert 8bit RGB frames to NV12 (4:2:0) to reduce the shared memory bandwidth, for video and games where chroma subsampling is acceptable",
+    .type           = OPTION_TYPE_BOOL,
+    .value.x_bool   = false,
+  },
+  {
+    .module         = "app",
+    .name           = "pipeline",
+    .description    = "Capture the next frame while the last is copied to the shared memory, for higher frame rates at the cost of a frame copy of latency",
+    .type           = OPTION_TYPE_BOOL,
+    .value.x_bool   = false,
+  },
+  {
+    .module         = "app",
+    .name           = "writeThreads",
+    .description    = "The number of threads that copy each frame to the shared memory, more can help with large frames such as 4K HDR",
+    .type           = OPTION_TYPE_INT,
+    .value.x_int    = 1,
+    .validator      = validateWriteThreads,
+  },
+  {
+    .module         = "app",
+    .name           = "dedupe",
+    .description    = "Don't post frames that are identical to the last one, this enables the pipeline",
+    .type           = OPTION_TYPE_BOOL,
+    .value.x_bool   = false,
+  },
+  {
+    .module         = "app",
+    .name           = "maxFPS",
+    .description    = "The maximum rate to capture at (0 = unlimited)",
+    .type           = OPTION_TYPE_INT,
+    .value.x_int    = 0,
+    .validator      = validateFPS,
+  },
+  {
+    .module         = "app",
+    .name           = "idleFPS",
+    .description    = "The rate to back off to while app:dedupe finds the captured frames unchanged, for capture interfaces that do not wait for changes themselves (0 = never back off)",
+    .type           = OPTION_TYPE_INT,
+    .value.x_int    = 0,
+    .validator      = validateFPS,
+  },
+  {
+    .module         = "app",
+    .name           = "record",
+    .description    = "Record the captured frames and cursor of the first output to this file, for playback with the Replay capture interface",
+    .type           = OPTION_TYPE_STRING,
+    .value.x_string = "",
+  },
   {0}
 };
 
+static bool frameQueuesHaveSubs(void)
+{
+  for(unsigned int i = 0; i < app.outputCount; ++i)
+    if (lgmpHostQueueHasSubs(app.outputs[i].frameQueue))
+      return true;
+  return false;
+}
+
 static bool lgmpTimer(void * opaque)
 {
   LGMP_STATUS status;
@@ -134,31 +357,296 @@ static bool lgmpTimer(void * opaque)
     return false;
   }
 
+  lgSignalEvent(app.queueEvent);
+  if (lgmpHostQueueHasSubs(app.pointerQueue) || frameQueuesHaveSubs())
+    lgSignalEvent(app.subsEvent);
+
   return true;
 }
 
+static bool frameQueuesFull(void)
+{
+  for(unsigned int i = 0; i < app.outputCount; ++i)
+    if (lgmpHostQueuePending(app.outputs[i].frameQueue) <
+        app.outputs[i].queueDepth)
+      return false;
+  return true;
+}
+
+static bool outputQueueFull(struct Output * out)
+{
+  return lgmpHostQueuePending(out->frameQueue) >= out->queueDepth;
+}
+
+/**
+ * Wait while the queue is full, returns false if the app is stopping.
+ *
+ * Clients release messages in the shared memory without notifying us, so
+ * there is nothing to block on until space frees up. As a frame is usually
+ * released shortly after the previous one we spin for a while first, for as
+ * long as recent waits needed, before sleeping in 1ms steps. The LGMP timer
+ * wakes us early once it has processed the queues, which is when timed out
+ * subscribers free their messages.
+ */
+static bool waitQueue(struct QueueWait * wait, struct Output * out)
+{
+  if (!(out ? outputQueueFull(out) : frameQueuesFull()))
+    return true;
+
+  if (!wait->spinLimit)
+    wait->spinLimit = QUEUE_SPIN_MIN;
+
+  ++wait->count;
+  const uint64_t start = microtime();
+  uint64_t now = start;
+  bool full;
+
+  while((full = out ? outputQueueFull(out) : frameQueuesFull()) &&
+      app.state == APP_STATE_RUNNING &&
+      now - start < wait->spinLimit)
+  {
+    __builtin_ia32_pause();
+    now = microtime();
+  }
+
+  if (!full)
+  {
+    // allow twice the time it took, to cover the next wait
+    const uint64_t took = (now - start) * 2;
+    wait->spinLimit = took > QUEUE_SPIN_MAX ? QUEUE_SPIN_MAX :
+      took < QUEUE_SPIN_MIN ? QUEUE_SPIN_MIN : took;
+    wait->spinTime += now - start;
+    kvmfr_stats_add(&app.stats->stages[KVMFR_STAT_QUEUE_WAIT], now - start);
+    return true;
+  }
+
+  // spinning did not help, spin less next time
+  wait->spinLimit /= 2;
+  if (wait->spinLimit < QUEUE_SPIN_MIN)
+    wait->spinLimit = QUEUE_SPIN_MIN;
+  wait->spinTime += now - start;
+
+  const uint64_t sleepStart = now;
+  while(app.state == APP_STATE_RUNNING &&
+      (out ? outputQueueFull(out) : frameQueuesFull()))
+    lgWaitEvent(app.queueEvent, 1);
+
+  now = microtime();
+  wait->sleepTime += now - sleepStart;
+  kvmfr_stats_add(&app.stats->stages[KVMFR_STAT_QUEUE_WAIT], now - start);
+  return app.state == APP_STATE_RUNNING;
+}
+
+static bool writeFrame(const struct FrameWrite * write, FrameBuffer * frame,
+    const void * src, size_t size)
+{
+  if (write->type == FRAME_TYPE_NV12)
+    return framebuffer_write_nv12(frame, src, write->height, write->width,
+        write->srcPitch, write->pitch, write->format == CAPTURE_FMT_RGBA);
+
+  if (write->compression == FRAME_COMPRESSION_RLE)
+    return framebuffer_write_rle(frame, src, write->height, write->width,
+        write->srcPitch);
+
+  return framebuffer_write(frame, src, size);
+}
+
+// resend the last frame to any new subscribers
+static void resendFrames(void)
+{
+  for(unsigned int i = 0; i < app.outputCount; ++i)
+  {
+    struct Output * out = &app.outputs[i];
+    if (!out->frameValid || lgmpHostQueueNewSubs(out->frameQueue) == 0)
+      continue;
+
+    LGMP_STATUS status;
+    if ((status = lgmpHostQueuePost(out->frameQueue, 0,
+            out->frameMemory[out->frameIndex])) != LGMP_OK)
+      DEBUG_ERROR("%s", lgmpStatusString(status));
+  }
+}
+
+/**
+ * Post the captured frame to the queue of its output and write the data.
+ * If staged is NULL the data is written by the capture interface, otherwise
+ * it is the frame data as captured into local memory.
+ */
+static void sendFrame(const CaptureFrame * frame, uint64_t captureTime,
+    const void * staged)
+{
+  const long pageSize = sysinfo_getPageSize();
+
+  if (frame->output >= app.outputCount)
+  {
+    DEBUG_ERROR("Invalid output %u, skipping frame", frame->output);
+    return;
+  }
+
+  // wait until there is room in the queue for this output
+  struct Output * out = &app.outputs[frame->output];
+  if (!waitQueue(&app.outputWait, out))
+    return;
+
+  // we increment the index first so that if we need to repeat a frame
+  // the index still points to the latest valid frame
+  if (++out->frameIndex == out->queueDepth)
+    out->frameIndex = 0;
+
+  KVMFRFrame * fi = lgmpHostMemPtr(out->frameMemory[out->frameIndex]);
+  switch(frame->format)
+  {
+    case CAPTURE_FMT_BGRA   : fi->type = FRAME_TYPE_BGRA   ; break;
+    case CAPTURE_FMT_RGBA   : fi->type = FRAME_TYPE_RGBA   ; break;
+    case CAPTURE_FMT_RGBA10 : fi->type = FRAME_TYPE_RGBA10 ; break;
+    case CAPTURE_FMT_RGBA16F: fi->type = FRAME_TYPE_RGBA16F; break;
+    default:
+      DEBUG_ERROR("Unsupported frame format %d, skipping frame", frame->format);
+      out->damageLost = true;
+      return;
+  }
+
+  switch(frame->rotation)
+  {
+    case CAPTURE_ROT_0  : fi->rotation = FRAME_ROT_0  ; break;
+    case CAPTURE_ROT_90 : fi->rotation = FRAME_ROT_90 ; break;
+    case CAPTURE_ROT_180: fi->rotation = FRAME_ROT_180; break;
+    case CAPTURE_ROT_270: fi->rotation = FRAME_ROT_270; break;
+    default:
+      DEBUG_WARN("Unsupported frame rotation %d", frame->rotation);
+      fi->rotation = FRAME_ROT_0;
+      break;
+  }
+
+  // convert to NV12 if enabled, the client does the color conversion
+  const bool nv12 = app.nv12 &&
+    (fi->type == FRAME_TYPE_BGRA || fi->type == FRAME_TYPE_RGBA);
+  if (nv12)
+    fi->type = FRAME_TYPE_NV12;
+
+  // compress if enabled and the worst case output fits in the frame
+  const bool rle =
+    app.compress && !nv12 && fi->type != FRAME_TYPE_RGBA16F &&
+    framebuffer_rle_bound(frame->width, frame->height) <=
+      app.frameBlocksPerFrame * FRAME_BLOCK_SIZE - pageSize;
+
+  if (frame->formatVer != out->captureFormatVer || rle != out->compressed)
+  {
+    out->captureFormatVer = frame->formatVer;
+    out->compressed       = rle;
+    ++out->formatVer;
+  }
+
+  // compressed frames decode into tightly packed rows, NV12 rows are
+  // padded to keep them 4 byte aligned
+  fi->formatVer         = out->formatVer;
+  fi->compression       = rle ? FRAME_COMPRESSION_RLE : FRAME_COMPRESSION_NONE;
+  fi->width             = frame->width;
+  fi->height            = frame->height;
+  fi->stride            = rle || nv12 ? frame->width : frame->stride;
+  fi->pitch             =
+    nv12 ? (frame->width + 3) & ~3 :
+    rle  ? frame->width * 4        : frame->pitch;
+  fi->offset            = pageSize - FrameBufferStructSize;
+  fi->mouseScalePercent = app.iface->getMouseScale();
+  fi->blockScreensaver  = os_blockScreensaver();
+  fi->frameSerial       = ++out->frameSerial;
+  fi->captureTime       = captureTime;
+  fi->writeTime         = 0;
+  fi->frameInterval     = frame->interval;
+  out->frameValid       = true;
+
+  // if a frame was dropped the client has not seen its damage, send it all
+  if (out->damageLost || frame->damageRectsCount > KVMFR_MAX_DAMAGE_RECTS)
+    fi->damageRectsCount = 0;
+  else
+  {
+    fi->damageRectsCount = frame->damageRectsCount;
+    memcpy(fi->damageRects, frame->damageRects,
+        frame->damageRectsCount * sizeof(FrameDamageRect));
+  }
+  out->damageLost = false;
+
+  // put the framebuffer on the border of the next page
+  // this is to allow for aligned DMA transfers by the receiver
+  FrameBuffer * fb = (FrameBuffer *)(((uint8_t*)fi) + fi->offset);
+  framebuffer_prepare(fb);
+
+  /* we post and then get the frame, this is intentional! */
+  LGMP_STATUS status;
+  fi->postTime = microtime();
+  if ((status = lgmpHostQueuePost(out->frameQueue, 0,
+          out->frameMemory[out->frameIndex])) != LGMP_OK)
+  {
+    DEBUG_ERROR("%s", lgmpStatusString(status));
+    out->damageLost = true;
+    return;
+  }
+
+  const struct FrameWrite write =
+  {
+    .type        = fi->type,
+    .compression = fi->compression,
+    .format      = frame->format,
+    .width       = frame->width,
+    .height      = frame->height,
+    .srcPitch    = frame->pitch,
+    .pitch       = fi->pitch
+  };
+
+  if (staged)
+    writeFrame(&write, fb, staged, frame->height * frame->pitch);
+  else
+  {
+    app.write       = write;
+    app.recordFrame = frame;
+    app.iface->getFrame(fb);
+  }
+  fi->writeTime = microtime();
+
+  atomic_fetch_add_explicit(&app.stats->framesPosted, 1, memory_order_relaxed);
+  kvmfr_stats_add(&app.stats->stages[KVMFR_STAT_COPY],
+      fi->writeTime - fi->postTime);
+  kvmfr_stats_add(&app.stats->stages[KVMFR_STAT_LATENCY],
+      fi->writeTime - captureTime);
+}
+
 static int frameThread(void * opaque)
 {
   DEBUG_INFO("Frame thread started");
 
-  bool         frameValid     = false;
-  bool         repeatFrame    = false;
-  CaptureFrame frame          = { 0 };
-  const long   pageSize       = sysinfo_getPageSize();
+  CaptureFrame frame = { 0 };
 
   while(app.state == APP_STATE_RUNNING)
   {
-    //wait until there is room in the queue
-    if(lgmpHostQueuePending(app.frameQueue) == LGMP_Q_FRAME_LEN)
+    //wait until there is room in a queue
+    if (!waitQueue(&app.frameWait, NULL))
+      break;
+
+    // when pipelined wait until there is a free staging buffer
+    struct StagedFrame * staged = NULL;
+    if (app.pipeline)
     {
-      usleep(1);
-      continue;
+      const unsigned int sw =
+        atomic_load_explicit(&app.stagedWrite, memory_order_relaxed);
+      if (sw - atomic_load_explicit(&app.stagedRead, memory_order_acquire) ==
+          STAGED_FRAMES)
+      {
+        lgWaitEvent(app.stagedFree, 100);
+        continue;
+      }
+      staged = &app.staged[sw % STAGED_FRAMES];
     }
 
-    switch(app.iface->waitFrame(&frame))
+    const uint64_t waitStart = microtime();
+    const CaptureResult result =
+      app.iface->waitFrame(staged ? &staged->frame : &frame);
+
+    switch(result)
     {
       case CAPTURE_RESULT_OK:
-        repeatFrame = false;
+        kvmfr_stats_add(&app.stats->stages[KVMFR_STAT_WAIT_FRAME],
+            microtime() - waitStart);
         break;
 
       case CAPTURE_RESULT_REINIT:
@@ -176,86 +664,199 @@ static int frameThread(void * opaque)
 
       case CAPTURE_RESULT_TIMEOUT:
       {
-        if (frameValid && lgmpHostQueueNewSubs(app.frameQueue) > 0)
-        {
-          // resend the last frame
-          repeatFrame = true;
-          break;
-        }
-
+        // when pipelined the copy stage does this when it is idle
+        if (!app.pipeline)
+          resendFrames();
         continue;
       }
     }
 
-    LGMP_STATUS status;
-
-    // if we are repeating a frame just send the last frame again
-    if (repeatFrame)
+    const uint64_t captureTime = microtime();
+    if (!staged)
     {
-      if ((status = lgmpHostQueuePost(app.frameQueue, 0, app.frameMemory[app.frameIndex])) != LGMP_OK)
-        DEBUG_ERROR("%s", lgmpStatusString(status));
+      sendFrame(&frame, captureTime, NULL);
       continue;
     }
 
-    // we increment the index first so that if we need to repeat a frame
-    // the index still points to the latest valid frame
-    if (++app.frameIndex == LGMP_Q_FRAME_LEN)
-      app.frameIndex = 0;
+    // store the frame as captured and hand it to the copy stage
+    framebuffer_prepare(staged->fb);
+    app.recordFrame = &staged->frame;
+    app.iface->getFrame(staged->fb);
+    staged->captureTime = captureTime;
+    staged->hash        = app.stagedHash;
+
+    atomic_fetch_add_explicit(&app.stagedWrite, 1, memory_order_release);
+    lgSignalEvent(app.stagedReady);
+  }
+  DEBUG_INFO("Frame thread stopped");
+  return 0;
+}
+
+static void logQueueWait(const char * name, struct QueueWait * wait)
+{
+  if (wait->count)
+    DEBUG_INFO("%s waits: %" PRIu64 ", spinning: %" PRIu64 " ms, sleeping: %" PRIu64 " ms",
+        name, wait->count, wait->spinTime / 1000, wait->sleepTime / 1000);
+
+  memset(wait, 0, sizeof(*wait));
+}
+
+/* new subscribers are still sent the last frame posted by resendFrames */
+static bool isDuplicate(const struct StagedFrame * staged)
+{
+  if (!app.dedupe || staged->frame.output >= app.outputCount)
+    return false;
+
+  struct Output * out = &app.outputs[staged->frame.output];
+  if (out->frameValid && !out->damageLost &&
+      out->frameHash    == staged->hash &&
+      out->frameHashVer == staged->frame.formatVer)
+    return true;
+
+  out->frameHash    = staged->hash;
+  out->frameHashVer = staged->frame.formatVer;
+  return false;
+}
+
+static int copyThread(void * opaque)
+{
+  DEBUG_INFO("Copy thread started");
 
-    KVMFRFrame * fi = lgmpHostMemPtr(app.frameMemory[app.frameIndex]);
-    switch(frame.format)
+  while(app.state == APP_STATE_RUNNING)
+  {
+    const unsigned int sr =
+      atomic_load_explicit(&app.stagedRead, memory_order_relaxed);
+    if (sr == atomic_load_explicit(&app.stagedWrite, memory_order_acquire))
     {
-      case CAPTURE_FMT_BGRA   : fi->type = FRAME_TYPE_BGRA   ; break;
-      case CAPTURE_FMT_RGBA   : fi->type = FRAME_TYPE_RGBA   ; break;
-      case CAPTURE_FMT_RGBA10 : fi->type = FRAME_TYPE_RGBA10 ; break;
-      case CAPTURE_FMT_RGBA16F: fi->type = FRAME_TYPE_RGBA16F; break;
-      default:
-        DEBUG_ERROR("Unsupported frame format %d, skipping frame", frame.format);
-        continue;
+      if (!lgWaitEvent(app.stagedReady, 100))
+        resendFrames();
+      continue;
     }
 
-    switch(frame.rotation)
+    const struct StagedFrame * staged = &app.staged[sr % STAGED_FRAMES];
+    if (isDuplicate(staged))
     {
-      case CAPTURE_ROT_0  : fi->rotation = FRAME_ROT_0  ; break;
-      case CAPTURE_ROT_90 : fi->rotation = FRAME_ROT_90 ; break;
-      case CAPTURE_ROT_180: fi->rotation = FRAME_ROT_180; break;
-      case CAPTURE_ROT_270: fi->rotation = FRAME_ROT_270; break;
-      default:
-        DEBUG_WARN("Unsupported frame rotation %d", frame.rotation);
-        fi->rotation = FRAME_ROT_0;
-        break;
+      atomic_fetch_add_explicit(&app.dupFrames, 1, memory_order_relaxed);
+      atomic_fetch_add_explicit(&app.stats->framesDuplicate, 1,
+          memory_order_relaxed);
+      atomic_store_explicit(&app.lastFrameDup, true, memory_order_relaxed);
     }
-
-    fi->formatVer         = frame.formatVer;
-    fi->width             = frame.width;
-    fi->height            = frame.height;
-    fi->stride            = frame.stride;
-    fi->pitch             = frame.pitch;
-    fi->offset            = pageSize - FrameBufferStructSize;
-    fi->mouseScalePercent = app.iface->getMouseScale();
-    fi->blockScreensaver  = os_blockScreensaver();
-    frameValid            = true;
-
-    // put the framebuffer on the border of the next page
-    // this is to allow for aligned DMA transfers by the receiver
-    FrameBuffer * fb = (FrameBuffer *)(((uint8_t*)fi) + fi->offset);
-    framebuffer_prepare(fb);
-
-    /* we post and then get the frame, this is intentional! */
-    if ((status = lgmpHostQueuePost(app.frameQueue, 0, app.frameMemory[app.frameIndex])) != LGMP_OK)
+    else
     {
-      DEBUG_ERROR("%s", lgmpStatusString(status));
-      continue;
+      atomic_store_explicit(&app.lastFrameDup, false, memory_order_relaxed);
+      sendFrame(&staged->frame, staged->captureTime,
+          framebuffer_get_data(staged->fb));
     }
-    app.iface->getFrame(fb);
+
+    atomic_fetch_add_explicit(&app.stagedRead, 1, memory_order_release);
+    lgSignalEvent(app.stagedFree);
   }
-  DEBUG_INFO("Frame thread stopped");
+  DEBUG_INFO("Copy thread stopped");
   return 0;
 }
 
+static void governorLog(void)
+{
+  struct Governor * gov = &app.governor;
+  const uint64_t elapsed = microtime() - gov->start;
+  if (gov->captures && elapsed)
+    DEBUG_INFO("Capture governor: %" PRIu64 " captures, waited %" PRIu64 " of %" PRIu64 " ms (%.1f%%) instead of capturing",
+        gov->captures, gov->waited / 1000, elapsed / 1000,
+        (double)gov->waited * 100.0 / elapsed);
+
+  gov->start    = microtime();
+  gov->waited   = 0;
+  gov->captures = 0;
+
+  const uint64_t dups = atomic_exchange(&app.dupFrames, 0);
+  if (dups)
+    DEBUG_INFO("Suppressed %" PRIu64 " duplicate frames", dups);
+}
+
+static void governorReset(void)
+{
+  struct Governor * gov = &app.governor;
+  const int maxFPS  = option_get_int("app", "maxFPS" );
+  const int idleFPS = option_get_int("app", "idleFPS");
+
+  gov->minInterval  = maxFPS  ? 1000000 / maxFPS  : 0;
+  gov->idleInterval = idleFPS ? 1000000 / idleFPS : 0;
+  if (gov->idleInterval && gov->idleInterval < gov->minInterval)
+    gov->idleInterval = gov->minInterval;
+
+  gov->interval = gov->minInterval;
+  gov->last     = 0;
+  gov->start    = microtime();
+  gov->waited   = 0;
+  gov->captures = 0;
+}
+
+/* wait until the next capture is due, activity returns to the full rate */
+static void governorWait(void)
+{
+  struct Governor * gov = &app.governor;
+  const uint64_t start = microtime();
+  uint64_t now = start;
+
+  // the wait is in milliseconds, less than one early is close enough
+  while(app.state == APP_STATE_RUNNING && gov->last + gov->interval >= now + 1000)
+  {
+    if (lgWaitEvent(app.activityEvent, (gov->last + gov->interval - now) / 1000))
+      gov->interval = gov->minInterval;
+    now = microtime();
+  }
+
+  gov->waited += now - start;
+  gov->last    = now;
+  ++gov->captures;
+
+  if (now - gov->start >= 60000000)
+    governorLog();
+}
+
+/* back off progressively while idle, doubling the interval up to the idle
+ * rate, anything else returns to the full rate immediately */
+static void governorUpdate(bool idle)
+{
+  struct Governor * gov = &app.governor;
+  if (!idle || !gov->idleInterval)
+  {
+    gov->interval = gov->minInterval;
+    return;
+  }
+
+  unsigned int interval = gov->interval ? gov->interval * 2 : 1000;
+  if (interval > gov->idleInterval)
+    interval = gov->idleInterval;
+  if (interval < gov->minInterval)
+    interval = gov->minInterval;
+  gov->interval = interval;
+}
+
 bool startThreads(void)
 {
   app.state = APP_STATE_RUNNING;
+  for(unsigned int i = 0; i < app.outputCount; ++i)
+  {
+    app.outputs[i].frameValid = false;
+    app.outputs[i].damageLost = true;
+  }
+
+  atomic_store(&app.lastFrameDup, false);
+  if (app.pipeline)
+  {
+    atomic_store(&app.stagedWrite, 0);
+    atomic_store(&app.stagedRead , 0);
+    lgResetEvent(app.stagedReady);
+    lgResetEvent(app.stagedFree );
+
+    if (!lgCreateThread("CopyThread", copyThread, NULL, &app.copyThread))
+    {
+      DEBUG_ERROR("Failed to create the copy thread");
+      return false;
+    }
+  }
+
   if (!lgCreateThread("FrameThread", frameThread, NULL, &app.frameThread))
   {
     DEBUG_ERROR("Failed to create the frame thread");
@@ -280,6 +881,17 @@ bool stopThreads(void)
   }
   app.frameThread = NULL;
 
+  if (app.copyThread && !lgJoinThread(app.copyThread, NULL))
+  {
+    DEBUG_WARN("Failed to join the copy thread");
+    ok = false;
+  }
+  app.copyThread = NULL;
+
+  logQueueWait("Frame queue", &app.frameWait );
+  logQueueWait("Output queue", &app.outputWait);
+  governorLog();
+
   return ok;
 }
 
@@ -294,12 +906,61 @@ static bool captureStart(void)
     }
   }
 
-  const unsigned int maxFrameSize = app.iface->getMaxFrameSize();
-  if (maxFrameSize > app.maxFrameSize)
+  // each frame needs a page for the KVMFRFrame header followed by the data
+  unsigned int maxFrameSize = app.iface->getMaxFrameSize();
+
+  app.compress = option_get_bool("app", "compress");
+  app.nv12     = option_get_bool("app", "nv12"    );
+  app.pipeline = option_get_bool("app", "pipeline");
+  app.dedupe   = option_get_bool("app", "dedupe"  );
+
+  // frames must be staged to be compared before they are posted
+  if (app.dedupe && !app.pipeline)
+  {
+    DEBUG_INFO("Duplicate frame suppression enables the pipeline");
+    app.pipeline = true;
+  }
+
+  // the staging buffers hold the frames as captured
+  const size_t stagedSize = FrameBufferStructSize + maxFrameSize;
+  if (app.pipeline && stagedSize > app.stagedSize)
+  {
+    for(int i = 0; i < STAGED_FRAMES; ++i)
+    {
+      free(app.staged[i].fb);
+      app.staged[i].fb = (FrameBuffer *)malloc(stagedSize);
+      if (!app.staged[i].fb)
+      {
+        DEBUG_ERROR("Failed to allocate the staging buffers");
+        app.stagedSize = 0;
+        return false;
+      }
+    }
+    app.stagedSize = stagedSize;
+  }
+
+  // leave room for the per row overhead of incompressible frames
+  if (app.compress)
+    maxFrameSize += maxFrameSize / 64;
+
+  const unsigned int blocks       =
+    (sysinfo_getPageSize() + maxFrameSize + FRAME_BLOCK_SIZE - 1) /
+    FRAME_BLOCK_SIZE;
+
+  // the frame blocks are shared equally between the outputs
+  const unsigned int share = app.frameBlockCount / app.outputCount;
+
+  unsigned int depth = option_get_int("app", "queueDepth");
+  if (!depth)
+    depth = LGMP_Q_FRAME_LEN;
+  if (depth > share / blocks)
+    depth = share / blocks;
+
+  if (depth < 2)
   {
     DEBUG_ERROR("Maximum frame size of %d bytes exceeds maximum space available", maxFrameSize);
 
-    const float needed = ((maxFrameSize * 2) / 1048576.0f) + 10.0f;
+    const float needed = ((maxFrameSize * 2 * app.outputCount) / 1048576.0f) + 10.0f;
     const int   size   = (int)powf(2.0f, ceilf(logf(needed) / logf(2.0f)));
 
     char * msg;
@@ -311,6 +972,26 @@ static bool captureStart(void)
   }
   DEBUG_INFO("Capture Size     : %u MiB (%u)", maxFrameSize / 1048576, maxFrameSize);
 
+  for(unsigned int o = 0; o < app.outputCount; ++o)
+  {
+    struct Output * out = &app.outputs[o];
+    if (blocks != app.frameBlocksPerFrame || depth != out->queueDepth)
+    {
+      // the frames are moving, make sure the clients setup the format again
+      out->queueDepth = depth;
+      for(unsigned int i = 0; i < depth; ++i)
+        out->frameMemory[i] = app.frameBlocks[o * share + i * blocks];
+      ++out->formatVer;
+    }
+    out->frameIndex = 0;
+  }
+  app.frameBlocksPerFrame = blocks;
+
+  DEBUG_INFO("Outputs          : %u", app.outputCount);
+  DEBUG_INFO("Queue Depth      : %u", depth);
+
+  governorReset();
+
   DEBUG_INFO("==== [ Capture  Start ] ====");
   return true;
 }
@@ -336,98 +1017,193 @@ bool captureGetPointerBuffer(void ** data, uint32_t * size)
   return true;
 }
 
-static void sendPointer(bool newClient)
+/* identifies a shape by its content so that shapes which are seen again,
+ * such as when switching between the arrow and text cursors, can be posted
+ * from the cache and skipped by clients that still have them uploaded */
+static uint64_t pointerShapeID(const CapturePointer * pointer,
+    const uint8_t * data)
 {
-  PLGMPMemory mem;
-  if (app.pointerInfo.shapeUpdate || newClient)
+  const uint64_t prime = 0x100000001b3ULL;
+  uint64_t h = 0xcbf29ce484222325ULL;
+
+  const uint32_t params[] =
   {
-    if (!newClient)
-    {
-      // swap the latest shape buffer out of rotation
-      PLGMPMemory tmp  = app.pointerShape;
-      app.pointerShape = app.pointerMemory[app.pointerIndex];
-      app.pointerMemory[app.pointerIndex] = tmp;
-    }
+    pointer->format, pointer->hx, pointer->hy,
+    pointer->width, pointer->height, pointer->pitch
+  };
+  for(int i = 0; i < sizeof(params) / sizeof(*params); ++i)
+    h = (h ^ params[i]) * prime;
 
-    // use the last known shape buffer
-    mem = app.pointerShape;
+  const size_t size = pointer->height * pointer->pitch;
+  size_t i = 0;
+  for(; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+  {
+    uint64_t v;
+    memcpy(&v, data + i, sizeof(v));
+    h = (h ^ v) * prime;
+    h ^= h >> 32;
   }
-  else
-    mem = app.pointerMemory[app.pointerIndex];
-
-  if (++app.pointerIndex == POINTER_SHAPE_BUFFERS)
-    app.pointerIndex = 0;
 
-  uint32_t flags = 0;
-  KVMFRCursor *cursor = lgmpHostMemPtr(mem);
+  for(; i < size; ++i)
+    h = (h ^ data[i]) * prime;
 
-  if (app.pointerInfo.positionUpdate || newClient)
-  {
-    flags |= CURSOR_FLAG_POSITION;
-    cursor->x = app.pointerInfo.x;
-    cursor->y = app.pointerInfo.y;
-  }
+  // final avalanche, zero is reserved for unused entries
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h ? h : 1;
+}
 
-  if (app.pointerInfo.visible)
-    flags |= CURSOR_FLAG_VISIBLE;
+static void sendPointer(bool newClient)
+{
+  // there is nothing to send to a new client until the shape is known
+  if (newClient && !app.pointerShapeValid)
+    return;
 
-  if (app.pointerInfo.shapeUpdate)
+  if (!newClient)
   {
-    cursor->hx     = app.pointerInfo.hx;
-    cursor->hy     = app.pointerInfo.hy;
-    cursor->width  = app.pointerInfo.width;
-    cursor->height = app.pointerInfo.height;
-    cursor->pitch  = app.pointerInfo.pitch;
+    CursorType type;
     switch(app.pointerInfo.format)
     {
-      case CAPTURE_FMT_COLOR : cursor->type = CURSOR_TYPE_COLOR       ; break;
-      case CAPTURE_FMT_MONO  : cursor->type = CURSOR_TYPE_MONOCHROME  ; break;
-      case CAPTURE_FMT_MASKED: cursor->type = CURSOR_TYPE_MASKED_COLOR; break;
+      case CAPTURE_FMT_COLOR : type = CURSOR_TYPE_COLOR       ; break;
+      case CAPTURE_FMT_MONO  : type = CURSOR_TYPE_MONOCHROME  ; break;
+      case CAPTURE_FMT_MASKED: type = CURSOR_TYPE_MASKED_COLOR; break;
 
       default:
         DEBUG_ERROR("Invalid pointer type");
         return;
     }
 
+    PLGMPMemory mem = app.pointerMemory[app.pointerIndex];
+    const uint64_t id = pointerShapeID(&app.pointerInfo,
+        (const uint8_t *)lgmpHostMemPtr(mem) + sizeof(KVMFRCursor));
+
+    // look for the shape in the cache, otherwise replace the oldest entry
+    unsigned int index = 0;
+    for(unsigned int i = 0; i < POINTER_SHAPE_CACHE; ++i)
+    {
+      if (app.pointerShapes[i].id == id)
+      {
+        index = i;
+        break;
+      }
+
+      if (app.pointerShapes[i].lastUse < app.pointerShapes[index].lastUse)
+        index = i;
+    }
+
+    if (app.pointerShapes[index].id != id)
+    {
+      // swap the latest shape buffer out of rotation into the cache
+      app.pointerMemory[app.pointerIndex] = app.pointerShapes[index].mem;
+      app.pointerShapes[index].mem        = mem;
+      app.pointerShapes[index].id         = id;
+
+      if (++app.pointerIndex == POINTER_SHAPE_BUFFERS)
+        app.pointerIndex = 0;
+
+      KVMFRCursor *cursor = lgmpHostMemPtr(mem);
+      cursor->id     = id;
+      cursor->type   = type;
+      cursor->hx     = app.pointerInfo.hx;
+      cursor->hy     = app.pointerInfo.hy;
+      cursor->width  = app.pointerInfo.width;
+      cursor->height = app.pointerInfo.height;
+      cursor->pitch  = app.pointerInfo.pitch;
+    }
+
+    app.pointerShapes[index].lastUse = ++app.pointerShapeUse;
+    app.pointerShape      = index;
     app.pointerShapeValid = true;
   }
 
-  if ((app.pointerInfo.shapeUpdate || newClient) && app.pointerShapeValid)
-    flags |= CURSOR_FLAG_SHAPE;
+  uint32_t flags = CURSOR_FLAG_SHAPE;
+  if (app.pointerInfo.visible)
+    flags |= CURSOR_FLAG_VISIBLE;
 
   LGMP_STATUS status;
-  while ((status = lgmpHostQueuePost(app.pointerQueue, flags, mem)) != LGMP_OK)
+  while ((status = lgmpHostQueuePost(app.pointerQueue, flags,
+          app.pointerShapes[app.pointerShape].mem)) != LGMP_OK)
   {
     if (status == LGMP_ERR_QUEUE_FULL)
     {
+      atomic_fetch_add_explicit(&app.stats->pointerRetries, 1,
+          memory_order_relaxed);
       usleep(1);
       continue;
     }
 
     DEBUG_ERROR("lgmpHostQueuePost Failed (Pointer): %s", lgmpStatusString(status));
-    break;
+    return;
   }
+
+  atomic_fetch_add_explicit(&app.stats->pointerShapes, 1, memory_order_relaxed);
+}
+
+bool captureWriteFrame(FrameBuffer * frame, const void * src, size_t size)
+{
+  record_frame(app.recordFrame, src, size);
+
+  // staged frames are stored as captured, the copy stage converts them
+  if (app.pipeline)
+  {
+    if (app.dedupe)
+      return framebuffer_write_hash(frame, src, size, &app.stagedHash);
+    return framebuffer_write(frame, src, size);
+  }
+
+  return writeFrame(&app.write, frame, src, size);
 }
 
 void capturePostPointerBuffer(CapturePointer pointer)
 {
   LG_LOCK(app.pointerLock);
 
+  unsigned int output = app.pointerInfo.output;
   int x = app.pointerInfo.x;
   int y = app.pointerInfo.y;
 
   memcpy(&app.pointerInfo, &pointer, sizeof(CapturePointer));
 
-  /* if there was not a position update, restore the x & y */
+  /* if there was not a position update, restore the output, x & y */
   if (!pointer.positionUpdate)
   {
-    app.pointerInfo.x = x;
-    app.pointerInfo.y = y;
+    app.pointerInfo.output = output;
+    app.pointerInfo.x      = x;
+    app.pointerInfo.y      = y;
+  }
+  else
+  {
+    app.pointerPosValid = true;
+    atomic_fetch_add_explicit(&app.stats->pointerPositions, 1,
+        memory_order_relaxed);
   }
 
-  sendPointer(false);
+  /* position & visibility changes only update the slot, the queue is only
+   * used for the shape */
+  kvmfr_cursor_pos_write(app.cursorPos, app.pointerInfo.output,
+      app.pointerInfo.x, app.pointerInfo.y,
+      (app.pointerPosValid     ? CURSOR_FLAG_POSITION : 0) |
+      (app.pointerInfo.visible ? CURSOR_FLAG_VISIBLE  : 0));
+
+  // sendPointer moves the shape out of the pointer buffer
+  if (record_active())
+  {
+    void   * shape;
+    uint32_t shapeSize;
+    captureGetPointerBuffer(&shape, &shapeSize);
+    if (pointer.shapeUpdate && pointer.height * pointer.pitch < shapeSize)
+      shapeSize = pointer.height * pointer.pitch;
+    record_cursor(&pointer, shape, pointer.shapeUpdate ? shapeSize : 0);
+  }
+
+  if (pointer.shapeUpdate)
+    sendPointer(false);
 
   LG_UNLOCK(app.pointerLock);
+
+  // the user is likely doing something, capture at the full rate
+  lgSignalEvent(app.activityEvent);
 }
 
 // this is called from the platform specific startup routine
@@ -502,32 +1278,115 @@ int app_main(int argc, char * argv[])
   DEBUG_INFO("Max Pointer Size : %u KiB", (unsigned int)MAX_POINTER_SIZE / 1024);
   DEBUG_INFO("KVMFR Version    : %u", KVMFR_VERSION);
 
+  const char * recordPath = option_get_string("app", "record");
+  if (*recordPath && !record_open(recordPath))
+  {
+    exitcode = LG_HOST_EXIT_FAILED;
+    goto fail_ivshmem;
+  }
+
+  const char * ifaceName = option_get_string("app", "capture");
+  CaptureInterface * iface = NULL;
+  for(int i = 0; CaptureInterfaces[i]; ++i)
+  {
+    iface = CaptureInterfaces[i];
+    if (*ifaceName && strcasecmp(ifaceName, iface->shortName))
+      continue;
+
+    DEBUG_INFO("Trying           : %s", iface->getName());
+
+    if (!iface->create(captureGetPointerBuffer, capturePostPointerBuffer,
+          captureWriteFrame))
+    {
+      iface = NULL;
+      continue;
+    }
+
+    /* converted or compressed frames must be written by the app, as must
+     * recorded frames */
+    if (iface->setSharedMemory && !record_active() &&
+        !option_get_bool("app", "nv12") && !option_get_bool("app", "compress"))
+      iface->setSharedMemory(&shmDev);
+
+    if (iface->init())
+      break;
+
+    iface->free();
+    iface = NULL;
+  }
+
+  if (!iface)
+  {
+    if (*ifaceName)
+      DEBUG_ERROR("Specified capture interface not supported");
+    else
+      DEBUG_ERROR("Failed to find a supported capture interface");
+    exitcode = LG_HOST_EXIT_FAILED;
+    goto fail_ivshmem;
+  }
+
+  DEBUG_INFO("Using            : %s", iface->getName());
+
+  app.outputCount = iface->getOutputCount ? iface->getOutputCount() : 1;
+  if (app.outputCount < 1 || app.outputCount > KVMFR_MAX_OUTPUTS)
+  {
+    DEBUG_ERROR("Unsupported number of outputs: %u", app.outputCount);
+    iface->deinit();
+    iface->free();
+    exitcode = LG_HOST_EXIT_FAILED;
+    goto fail_ivshmem;
+  }
+
+  /* the cursor position slot and the statistics are placed at the end of the
+   * shared memory, outside of the area managed by LGMP */
+  const uint32_t cursorPosOffset =
+    (shmDev.size - sizeof(KVMFRCursorPos)) & ~63U;
+  app.cursorPos = (KVMFRCursorPos *)((uint8_t *)shmDev.mem + cursorPosOffset);
+  memset(app.cursorPos, 0, sizeof(*app.cursorPos));
+  app.pointerPosValid = false;
+
+  const uint32_t statsOffset =
+    (cursorPosOffset - sizeof(KVMFRStats)) & ~63U;
+  app.stats = (KVMFRStats *)((uint8_t *)shmDev.mem + statsOffset);
+  memset(app.stats, 0, sizeof(*app.stats));
+
   KVMFR udata = {
-    .magic   = KVMFR_MAGIC,
-    .version = KVMFR_VERSION,
+    .magic     = KVMFR_MAGIC,
+    .version   = KVMFR_VERSION,
+    .outputs   = app.outputCount,
+    .cursorPos = cursorPosOffset,
+    .stats     = statsOffset
   };
   strncpy(udata.hostver, BUILD_VERSION, sizeof(udata.hostver)-1);
 
   LGMP_STATUS status;
-  if ((status = lgmpHostInit(shmDev.mem, shmDev.size, &app.lgmp,
+  if ((status = lgmpHostInit(shmDev.mem, statsOffset, &app.lgmp,
           sizeof(udata), (uint8_t *)&udata)) != LGMP_OK)
   {
     DEBUG_ERROR("lgmpHostInit Failed: %s", lgmpStatusString(status));
     exitcode = LG_HOST_EXIT_FATAL;
-    goto fail_ivshmem;
+    iface->deinit();
+    goto fail_lgmp;
   }
 
-  if ((status = lgmpHostQueueNew(app.lgmp, FRAME_QUEUE_CONFIG, &app.frameQueue)) != LGMP_OK)
+  for(unsigned int i = 0; i < app.outputCount; ++i)
   {
-    DEBUG_ERROR("lgmpHostQueueCreate Failed (Frame): %s", lgmpStatusString(status));
-    exitcode = LG_HOST_EXIT_FATAL;
-    goto fail_lgmp;
+    struct LGMPQueueConfig config = FRAME_QUEUE_CONFIG;
+    config.queueID = LGMP_Q_FRAME + i;
+    if ((status = lgmpHostQueueNew(app.lgmp, config, &app.outputs[i].frameQueue)) != LGMP_OK)
+    {
+      DEBUG_ERROR("lgmpHostQueueCreate Failed (Frame %u): %s", i, lgmpStatusString(status));
+      exitcode = LG_HOST_EXIT_FATAL;
+      iface->deinit();
+      goto fail_lgmp;
+    }
   }
 
   if ((status = lgmpHostQueueNew(app.lgmp, POINTER_QUEUE_CONFIG, &app.pointerQueue)) != LGMP_OK)
   {
     DEBUG_ERROR("lgmpHostQueueNew Failed (Pointer): %s", lgmpStatusString(status));
     exitcode = LG_HOST_EXIT_FATAL;
+    iface->deinit();
     goto fail_lgmp;
   }
 
@@ -537,75 +1396,88 @@ int app_main(int argc, char * argv[])
     {
       DEBUG_ERROR("lgmpHostMemAlloc Failed (Pointer): %s", lgmpStatusString(status));
       exitcode = LG_HOST_EXIT_FATAL;
+      iface->deinit();
       goto fail_lgmp;
     }
     memset(lgmpHostMemPtr(app.pointerMemory[i]), 0, MAX_POINTER_SIZE);
   }
 
   app.pointerShapeValid = false;
-  if ((status = lgmpHostMemAlloc(app.lgmp, MAX_POINTER_SIZE, &app.pointerShape)) != LGMP_OK)
+  app.pointerShapeUse   = 0;
+  for(int i = 0; i < POINTER_SHAPE_CACHE; ++i)
   {
-    DEBUG_ERROR("lgmpHostMemAlloc Failed (Pointer Shape): %s", lgmpStatusString(status));
-    exitcode = LG_HOST_EXIT_FATAL;
-    goto fail_lgmp;
+    app.pointerShapes[i].id      = 0;
+    app.pointerShapes[i].lastUse = 0;
+    if ((status = lgmpHostMemAlloc(app.lgmp, MAX_POINTER_SIZE, &app.pointerShapes[i].mem)) != LGMP_OK)
+    {
+      DEBUG_ERROR("lgmpHostMemAlloc Failed (Pointer Shape): %s", lgmpStatusString(status));
+      exitcode = LG_HOST_EXIT_FATAL;
+      iface->deinit();
+      goto fail_lgmp;
+    }
   }
 
+  /* the frame memory is allocated as a pool of blocks that is divided up
+   * between the frames according to the capture format when capture starts.
+   * LGMP allocates linearly so the blocks are contiguous, which is verified
+   * below as a frame may span several of them */
   const long sz = sysinfo_getPageSize();
-  app.maxFrameSize = lgmpHostMemAvail(app.lgmp);
-  app.maxFrameSize = (app.maxFrameSize - (sz - 1)) & ~(sz - 1);
-  app.maxFrameSize /= LGMP_Q_FRAME_LEN;
-  DEBUG_INFO("Max Frame Size   : %u MiB", (unsigned int)(app.maxFrameSize / 1048576LL));
+  app.frameBlockCount = (lgmpHostMemAvail(app.lgmp) - sz) / FRAME_BLOCK_SIZE;
+  app.frameBlocks     = calloc(app.frameBlockCount, sizeof(*app.frameBlocks));
+  if (!app.frameBlocks)
+  {
+    DEBUG_ERROR("Out of memory");
+    exitcode = LG_HOST_EXIT_FATAL;
+    iface->deinit();
+    goto fail_lgmp;
+  }
 
-  for(int i = 0; i < LGMP_Q_FRAME_LEN; ++i)
+  for(unsigned int i = 0; i < app.frameBlockCount; ++i)
   {
-    if ((status = lgmpHostMemAllocAligned(app.lgmp, app.maxFrameSize, sz, &app.frameMemory[i])) != LGMP_OK)
+    if ((status = lgmpHostMemAllocAligned(app.lgmp, FRAME_BLOCK_SIZE, sz, &app.frameBlocks[i])) != LGMP_OK)
     {
       DEBUG_ERROR("lgmpHostMemAlloc Failed (Frame): %s", lgmpStatusString(status));
       exitcode = LG_HOST_EXIT_FATAL;
+      iface->deinit();
       goto fail_lgmp;
     }
-  }
-
-  const char * ifaceName = option_get_string("app", "capture");
-  CaptureInterface * iface = NULL;
-  for(int i = 0; CaptureInterfaces[i]; ++i)
-  {
-    iface = CaptureInterfaces[i];
-    if (*ifaceName && strcasecmp(ifaceName, iface->shortName))
-      continue;
-
-    DEBUG_INFO("Trying           : %s", iface->getName());
 
-    if (!iface->create(captureGetPointerBuffer, capturePostPointerBuffer))
+    if ((uint8_t *)lgmpHostMemPtr(app.frameBlocks[i]) !=
+        (uint8_t *)lgmpHostMemPtr(app.frameBlocks[0]) + (size_t)i * FRAME_BLOCK_SIZE)
     {
-      iface = NULL;
-      continue;
+      DEBUG_ERROR("The frame memory blocks are not contiguous");
+      exitcode = LG_HOST_EXIT_FATAL;
+      iface->deinit();
+      goto fail_lgmp;
     }
-
-    if (iface->init())
-      break;
-
-    iface->free();
-    iface = NULL;
-  }
-
-  if (!iface)
-  {
-    if (*ifaceName)
-      DEBUG_ERROR("Specified capture interface not supported");
-    else
-      DEBUG_ERROR("Failed to find a supported capture interface");
-    exitcode = LG_HOST_EXIT_FAILED;
-    goto fail_lgmp;
   }
-
-  DEBUG_INFO("Using            : %s", iface->getName());
+  DEBUG_INFO("Frame Memory     : %u MiB", app.frameBlockCount * (FRAME_BLOCK_SIZE / 1048576));
 
   app.state = APP_STATE_RUNNING;
   app.iface = iface;
 
   LG_LOCK_INIT(app.pointerLock);
 
+  app.stagedReady = lgCreateEvent(true, 0);
+  app.stagedFree  = lgCreateEvent(true, 0);
+  app.queueEvent  = lgCreateEvent(true, 0);
+  app.subsEvent     = lgCreateEvent(true, 0);
+  app.activityEvent = lgCreateEvent(true, 0);
+  if (!app.stagedReady || !app.stagedFree || !app.queueEvent ||
+      !app.subsEvent || !app.activityEvent)
+  {
+    DEBUG_ERROR("Failed to create the events");
+
+    iface->deinit();
+    goto fail_timer;
+  }
+
+  if (!framebuffer_set_write_threads(option_get_int("app", "writeThreads")))
+  {
+    iface->deinit();
+    goto fail_timer;
+  }
+
   if (!lgCreateTimer(100, lgmpTimer, NULL, &app.lgmpTimer))
   {
     DEBUG_ERROR("Failed to create the LGMP timer");
@@ -617,7 +1489,7 @@ int app_main(int argc, char * argv[])
   while(app.state != APP_STATE_SHUTDOWN)
   {
     if(lgmpHostQueueHasSubs(app.pointerQueue) ||
-        lgmpHostQueueHasSubs(app.frameQueue))
+        frameQueuesHaveSubs())
     {
       if (!captureStart())
       {
@@ -633,13 +1505,14 @@ int app_main(int argc, char * argv[])
     }
     else
     {
-      usleep(100000);
+      // the LGMP timer signals once it sees a subscriber
+      lgWaitEvent(app.subsEvent, 100);
       continue;
     }
 
     while(app.state != APP_STATE_SHUTDOWN && (
           lgmpHostQueueHasSubs(app.pointerQueue) ||
-          lgmpHostQueueHasSubs(app.frameQueue)))
+          frameQueuesHaveSubs()))
     {
       if (app.state == APP_STATE_RESTART)
       {
@@ -675,14 +1548,29 @@ int app_main(int argc, char * argv[])
         LG_LOCK(app.pointerLock);
         sendPointer(true);
         LG_UNLOCK(app.pointerLock);
+        governorUpdate(false);
       }
 
-      switch(iface->capture())
+      governorWait();
+      const uint64_t captureBegin = microtime();
+      const CaptureResult result  = iface->capture();
+      kvmfr_stats_add(&app.stats->stages[KVMFR_STAT_CAPTURE],
+          microtime() - captureBegin);
+
+      switch(result)
       {
         case CAPTURE_RESULT_OK:
+          // back off if the interface polled and nothing changed
+          governorUpdate(
+              atomic_load_explicit(&app.lastFrameDup, memory_order_relaxed));
           break;
 
         case CAPTURE_RESULT_TIMEOUT:
+          /* nothing changed, the interface has already waited for a change
+           * so capture again as soon as it allows */
+          atomic_fetch_add_explicit(&app.stats->captureTimeouts, 1,
+              memory_order_relaxed);
+          governorUpdate(false);
           continue;
 
         case CAPTURE_RESULT_REINIT:
@@ -728,18 +1616,37 @@ fail_capture:
   lgTimerDestroy(app.lgmpTimer);
 
 fail_timer:
-  iface->free();
+  framebuffer_set_write_threads(1);
   LG_LOCK_FREE(app.pointerLock);
+  if (app.stagedReady)
+    lgFreeEvent(app.stagedReady);
+  if (app.stagedFree)
+    lgFreeEvent(app.stagedFree);
+  if (app.queueEvent)
+    lgFreeEvent(app.queueEvent);
+  if (app.subsEvent)
+    lgFreeEvent(app.subsEvent);
+  if (app.activityEvent)
+    lgFreeEvent(app.activityEvent);
+  for(int i = 0; i < STAGED_FRAMES; ++i)
+    free(app.staged[i].fb);
 
 fail_lgmp:
-  for(int i = 0; i < LGMP_Q_FRAME_LEN; ++i)
-    lgmpHostMemFree(&app.frameMemory[i]);
+  if (app.frameBlocks)
+  {
+    for(unsigned int i = 0; i < app.frameBlockCount; ++i)
+      lgmpHostMemFree(&app.frameBlocks[i]);
+    free(app.frameBlocks);
+  }
   for(int i = 0; i < POINTER_SHAPE_BUFFERS; ++i)
     lgmpHostMemFree(&app.pointerMemory[i]);
-  lgmpHostMemFree(&app.pointerShape);
+  for(int i = 0; i < POINTER_SHAPE_CACHE; ++i)
+    lgmpHostMemFree(&app.pointerShapes[i].mem);
   lgmpHostFree(&app.lgmp);
+  iface->free();
 
 fail_ivshmem:
+  record_close();
   ivshmemClose(&shmDev);
   ivshmemFree(&shmDev);
   return exitcode;
@@ -0,0 +1,200 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017-2019 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "record.h"
+#include "replay.h"
+#include "common/debug.h"
+#include "common/locking.h"
+#include "common/time.h"
+
+#include <stdio.h>
+#include <string.h>
+
+struct record
+{
+  LG_Lock    lock;
+  FILE     * file;
+  uint64_t   startTime;
+};
+
+static struct record record = { 0 };
+
+static const uint8_t zeros[REPLAY_ALIGN] = { 0 };
+
+// on failure the recording is stopped, playback stops at the truncated record
+static bool record_write(const void * data, size_t size)
+{
+  if (!size || fwrite(data, 1, size, record.file) == size)
+    return true;
+
+  DEBUG_ERROR("Failed to write to the recording, recording stopped");
+  fclose(record.file);
+  record.file = NULL;
+  return false;
+}
+
+static bool record_pad(size_t size)
+{
+  while(size)
+  {
+    const size_t len = size < sizeof(zeros) ? size : sizeof(zeros);
+    if (!record_write(zeros, len))
+      return false;
+    size -= len;
+  }
+  return true;
+}
+
+static bool record_begin(uint32_t type, uint32_t size)
+{
+  const ReplayRecord rec =
+  {
+    .type      = type,
+    .size      = size,
+    .timestamp = microtime() - record.startTime
+  };
+
+  return record_write(&rec, sizeof(rec));
+}
+
+// pads the record that was just written out to the start of the next one
+static bool record_end(uint32_t size)
+{
+  const size_t used = sizeof(ReplayRecord) + size;
+  return record_pad(REPLAY_ALIGN_UP(used) - used);
+}
+
+bool record_open(const char * path)
+{
+  LG_LOCK_INIT(record.lock);
+
+  record.file = fopen(path, "wb");
+  if (!record.file)
+  {
+    DEBUG_ERROR("Failed to open the recording: %s", path);
+    return false;
+  }
+
+  ReplayHeader hdr = { .version = REPLAY_VERSION };
+  memcpy(hdr.magic, REPLAY_MAGIC, sizeof(hdr.magic));
+
+  if (!record_write(&hdr, sizeof(hdr)) ||
+      !record_pad(REPLAY_ALIGN_UP(sizeof(hdr)) - sizeof(hdr)))
+    return false;
+
+  record.startTime = microtime();
+  DEBUG_INFO("Recording to     : %s", path);
+  return true;
+}
+
+void record_close(void)
+{
+  if (!record.file)
+    return;
+
+  LG_LOCK(record.lock);
+  if (record.file)
+  {
+    fclose(record.file);
+    record.file = NULL;
+  }
+  LG_UNLOCK(record.lock);
+}
+
+bool record_active(void)
+{
+  return record.file != NULL;
+}
+
+void record_frame(const CaptureFrame * frame, const void * data, size_t size)
+{
+  if (!record.file || frame->output != 0 ||
+      frame->format > CAPTURE_FMT_RGBA16F)
+    return;
+
+  const size_t dataSize = (size_t)frame->pitch * frame->height;
+  if (size > dataSize)
+    size = dataSize;
+
+  ReplayFrame rf =
+  {
+    .width            = frame->width,
+    .height           = frame->height,
+    .pitch            = frame->pitch,
+    .stride           = frame->stride,
+    .format           = frame->format,
+    .dataOffset       = REPLAY_ALIGN_UP(sizeof(ReplayFrame)),
+    .damageRectsCount = frame->damageRectsCount
+  };
+  memcpy(rf.damageRects, frame->damageRects,
+      frame->damageRectsCount * sizeof(FrameDamageRect));
+
+  const uint32_t recSize = rf.dataOffset + dataSize;
+
+  LG_LOCK(record.lock);
+  if (record.file &&
+      record_begin(REPLAY_RECORD_FRAME, recSize) &&
+      record_write(&rf, sizeof(rf)) &&
+      record_pad(rf.dataOffset - sizeof(rf)) &&
+      record_write(data, size) &&
+      record_pad(dataSize - size))
+    record_end(recSize);
+  LG_UNLOCK(record.lock);
+}
+
+void record_cursor(const CapturePointer * pointer, const void * shape,
+    size_t shapeSize)
+{
+  if (!record.file)
+    return;
+
+  ReplayCursor rc =
+  {
+    .x = pointer->x,
+    .y = pointer->y
+  };
+
+  // positions on the other outputs can't be played back
+  if (pointer->positionUpdate && pointer->output == 0)
+    rc.flags |= REPLAY_CURSOR_FLAG_POSITION;
+  if (pointer->visible)
+    rc.flags |= REPLAY_CURSOR_FLAG_VISIBLE;
+
+  if (pointer->shapeUpdate)
+  {
+    rc.flags    |= REPLAY_CURSOR_FLAG_SHAPE;
+    rc.format    = pointer->format;
+    rc.hx        = pointer->hx;
+    rc.hy        = pointer->hy;
+    rc.width     = pointer->width;
+    rc.height    = pointer->height;
+    rc.pitch     = pointer->pitch;
+    rc.shapeSize = shapeSize;
+  }
+
+  const uint32_t recSize = sizeof(rc) + rc.shapeSize;
+
+  LG_LOCK(record.lock);
+  if (record.file &&
+      record_begin(REPLAY_RECORD_CURSOR, recSize) &&
+      record_write(&rc, sizeof(rc)) &&
+      record_write(shape, rc.shapeSize))
+    record_end(recSize);
+  LG_UNLOCK(record.lock);
+}
@@ -49,6 +49,8 @@ typedef struct
 
   bool                 cursorVisible;
   KVMFRCursor          cursor;
+  KVMFRCursorPos     * cursorPos;
+  int16_t              cursorX, cursorY;
   os_sem_t           * cursorSem;
   atomic_uint          cursorVer;
   unsigned int         cursorCurVer;
@@ -208,11 +210,29 @@ static void * pointerThread(void * data)
     return NULL;
   }
 
+  uint32_t posSeq = 0;
   while(this->state == STATE_RUNNING)
   {
     LGMP_STATUS status;
     LGMPMessage msg;
 
+    uint32_t output;
+    int16_t  x, y;
+    uint32_t flags;
+    const bool posUpdate = kvmfr_cursor_pos_read(this->cursorPos, &posSeq,
+        &output, &x, &y, &flags);
+
+    if (posUpdate)
+    {
+      // only the first output is shown
+      this->cursorVisible = output == 0 && (flags & CURSOR_FLAG_VISIBLE);
+      if (output == 0 && (flags & CURSOR_FLAG_POSITION))
+      {
+        this->cursorX = x;
+        this->cursorY = y;
+      }
+    }
+
     if ((status = lgmpClientProcess(this->pointerQueue, &msg)) != LGMP_OK)
     {
       if (status != LGMP_ERR_QUEUE_EMPTY)
@@ -221,14 +241,12 @@ static void * pointerThread(void * data)
         break;
       }
 
-      usleep(1000);
+      if (!posUpdate)
+        usleep(1000);
       continue;
     }
 
     const KVMFRCursor * const cursor = (const KVMFRCursor * const)msg.mem;
-    this->cursorVisible =
-      msg.udata & CURSOR_FLAG_VISIBLE;
-
     if (msg.udata & CURSOR_FLAG_SHAPE)
     {
       os_sem_wait(this->cursorSem);
@@ -293,12 +311,6 @@ static void * pointerThread(void * data)
       os_sem_post(this->cursorSem);
     }
 
-    if (msg.udata & CURSOR_FLAG_POSITION)
-    {
-      this->cursor.x = cursor->x;
-      this->cursor.y = cursor->y;
-    }
-
     lgmpClientMessageDone(this->pointerQueue);
   }
 
@@ -346,6 +358,14 @@ static void lgUpdate(void * data, obs_data_t * settings)
     return;
   }
 
+  if (udata->cursorPos > this->shmDev.size - sizeof(KVMFRCursorPos))
+  {
+    printf("Invalid cursor position offset\n");
+    return;
+  }
+  this->cursorPos = (KVMFRCursorPos *)
+    ((uint8_t *)this->shmDev.mem + udata->cursorPos);
+
   this->state = STATE_STARTING;
   pthread_create(&this->frameThread, NULL, frameThread, this);
   pthread_setname_np(this->frameThread, "LGFrameThread");
@@ -370,8 +390,8 @@ static void lgVideoTick(void * data, float seconds)
     return;
   }
 
-  this->cursorRect.x = this->cursor.x;
-  this->cursorRect.y = this->cursor.y;
+  this->cursorRect.x = this->cursorX;
+  this->cursorRect.y = this->cursorY;
 
   /* update the cursor texture */
   unsigned int cursorVer = atomic_load(&this->cursorVer);
@@ -507,15 +527,25 @@ static void lgVideoTick(void * data, float seconds)
   if (this->texture)
   {
     FrameBuffer * fb = (FrameBuffer *)(((uint8_t*)frame) + frame->offset);
-    framebuffer_read(
-        fb,
-        this->texData,    // dst
-        this->linesize,   // dstpitch
-        frame->height,    // height
-        frame->width,     // width
-        this->bpp,        // bpp
-        frame->pitch      // linepitch
-    );
+    if (frame->compression == FRAME_COMPRESSION_RLE)
+      framebuffer_read_rle(
+          fb,
+          this->texData,    // dst
+          this->linesize,   // dstpitch
+          frame->height,    // height
+          frame->width,     // width
+          this->bpp         // bpp
+      );
+    else
+      framebuffer_read(
+          fb,
+          this->texData,    // dst
+          this->linesize,   // dstpitch
+          frame->height,    // height
+          frame->width,     // width
+          this->bpp,        // bpp
+          frame->pitch      // linepitch
+      );
 
     lgmpClientMessageDone(this->frameQueue);
     os_sem_post(this->frameSem);
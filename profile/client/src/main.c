@@ -18,12 +18,15 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 */
 
 #include "common/debug.h"
+#include "common/version.h"
 #include "common/option.h"
 #include "common/crash.h"
 #include "common/KVMFR.h"
 #include "common/locking.h"
 #include "common/stringutils.h"
 #include "common/ivshmem.h"
+#include "common/framebuffer.h"
+#include "common/time.h"
 
 #include <stdlib.h>
 #include <unistd.h>
@@ -104,6 +107,67 @@ static bool config_load(int argc, char * argv[])
   return true;
 }
 
+// a sample of the host statistics
+struct hostSample
+{
+  uint64_t count  [KVMFR_STAT_MAX];
+  uint64_t total  [KVMFR_STAT_MAX];
+  uint64_t buckets[KVMFR_STAT_MAX][KVMFR_STATS_BUCKETS];
+  uint64_t posted, duplicates, timeouts, retries;
+};
+
+static void hostStatsSample(KVMFRStats * stats, struct hostSample * s)
+{
+  for(int i = 0; i < KVMFR_STAT_MAX; ++i)
+  {
+    s->count[i] = atomic_load(&stats->stages[i].count);
+    s->total[i] = atomic_load(&stats->stages[i].total);
+    for(int b = 0; b < KVMFR_STATS_BUCKETS; ++b)
+      s->buckets[i][b] = atomic_load(&stats->stages[i].buckets[b]);
+  }
+
+  s->posted     = atomic_load(&stats->framesPosted   );
+  s->duplicates = atomic_load(&stats->framesDuplicate);
+  s->timeouts   = atomic_load(&stats->captureTimeouts);
+  s->retries    = atomic_load(&stats->pointerRetries );
+}
+
+static void hostStatsPrint(const struct hostSample * last,
+    const struct hostSample * now)
+{
+  static const char * names[KVMFR_STAT_MAX] =
+  {
+    [KVMFR_STAT_CAPTURE   ] = "capture",
+    [KVMFR_STAT_WAIT_FRAME] = "wait",
+    [KVMFR_STAT_COPY      ] = "copy",
+    [KVMFR_STAT_QUEUE_WAIT] = "queue",
+    [KVMFR_STAT_LATENCY   ] = "latency"
+  };
+
+  fprintf(stdout, "host posted:%" PRIu64 " dup:%" PRIu64 " timeouts:%" PRIu64
+      " pointer retries:%" PRIu64,
+      now->posted     - last->posted,
+      now->duplicates - last->duplicates,
+      now->timeouts   - last->timeouts,
+      now->retries    - last->retries);
+
+  for(int i = 0; i < KVMFR_STAT_MAX; ++i)
+  {
+    const uint64_t count = now->count[i] - last->count[i];
+    if (!count)
+      continue;
+
+    uint64_t buckets[KVMFR_STATS_BUCKETS];
+    for(int b = 0; b < KVMFR_STATS_BUCKETS; ++b)
+      buckets[b] = now->buckets[i][b] - last->buckets[i][b];
+
+    fprintf(stdout, ", %s avg:%.3f p99:%.3f ms", names[i],
+        ((double)(now->total[i] - last->total[i]) / count) / 1e3,
+        kvmfr_stats_percentile(buckets, 0.99) / 1e3);
+  }
+  fprintf(stdout, "\n");
+}
+
 static int run(void)
 {
   PLGMPClient      lgmp;
@@ -113,13 +177,21 @@ static int run(void)
   KVMFR *udata;
 
   LGMP_STATUS status;
-  if ((status = lgmpClientInit(state.shmDev.mem, state.shmDev.size, &lgmp,
-          &udataSize, (uint8_t **)&udata)) != LGMP_OK)
+  if ((status = lgmpClientInit(state.shmDev.mem, state.shmDev.size, &lgmp))
+      != LGMP_OK)
   {
     DEBUG_ERROR("lgmpClientInit: %s", lgmpStatusString(status));
     return -1;
   }
 
+  if ((status = lgmpClientSessionInit(lgmp, &udataSize, (uint8_t **)&udata))
+      != LGMP_OK)
+  {
+    DEBUG_ERROR("lgmpClientSessionInit: %s", lgmpStatusString(status));
+    lgmpClientFree(&lgmp);
+    return -1;
+  }
+
   if (udataSize != sizeof(KVMFR) ||
       memcmp(udata->magic, KVMFR_MAGIC, sizeof(udata->magic)) != 0 ||
       udata->version != KVMFR_VERSION)
@@ -131,6 +203,14 @@ static int run(void)
     return -1;
   }
 
+  if (udata->stats > state.shmDev.size - sizeof(KVMFRStats))
+  {
+    DEBUG_ERROR("Invalid statistics offset: 0x%x", udata->stats);
+    return -1;
+  }
+  KVMFRStats * hostStats =
+    (KVMFRStats *)((uint8_t *)state.shmDev.mem + udata->stats);
+
   if ((status = lgmpClientSubscribe(lgmp, LGMP_Q_FRAME, &frameQueue) != LGMP_OK))
   {
     DEBUG_ERROR("lgmpClientSubscribe: %s", lgmpStatusString(status));
@@ -145,11 +225,22 @@ static int run(void)
 
   unsigned int frameCount    = 0;
   uint64_t     lastFrameTime = 0;
+  uint32_t     lastSerial    = 0;
+  uint64_t     drops         = 0;
+  struct perf  writeLat      = {};
+  struct perf  displayLat    = {};
+  uint64_t     latencyStart  = 0;
+  int64_t      clockOffset    = 0;
+  int64_t      clockWindowMin = INT64_MAX;
+  uint64_t     clockWindow    = 0;
   struct perf  p1  = {};
   struct perf  p5  = {};
   struct perf  p10 = {};
   struct perf  p30 = {};
 
+  struct hostSample hostLast, hostNow;
+  hostStatsSample(hostStats, &hostLast);
+
   // start accepting frames
   while(state.running)
   {
@@ -163,8 +254,98 @@ static int run(void)
       return -1;
     }
 
+    KVMFRFrame  * frame = (KVMFRFrame *)msg.mem;
+    FrameBuffer * fb    = (FrameBuffer *)(((uint8_t*)frame) + frame->offset);
+
+    /* the host clock is unrelated to ours, estimate the offset from the
+     * smallest post to receive delay as the client does */
+    const uint64_t recvTime = microtime();
+    const int64_t  delta    = (int64_t)(recvTime - frame->postTime);
+    if (delta < clockWindowMin)
+      clockWindowMin = delta;
+
+    if (delta < clockOffset || recvTime - clockWindow > 10000000)
+    {
+      clockOffset = clockWindowMin;
+      if (recvTime - clockWindow > 10000000)
+      {
+        clockWindowMin = INT64_MAX;
+        clockWindow    = recvTime;
+      }
+    }
+
+    /* wait for the frame data as the client would before displaying it, the
+     * final size of compressed frames is unknown so for those the write time
+     * below is all there is to wait on */
+    uint64_t displayTime = 0;
+    if (frame->compression == FRAME_COMPRESSION_NONE)
+    {
+      size_t size = frame->height * frame->pitch;
+      if (frame->type == FRAME_TYPE_NV12)
+        size = frame->pitch * (frame->height + (frame->height + 1) / 2);
+      framebuffer_wait(fb, size);
+      displayTime = microtime();
+    }
+
+    /* the host only stores the write time once the write returns, which may
+     * be just after the data is complete */
+    const volatile uint64_t * writeTimePtr = &frame->writeTime;
+    const uint64_t deadline = microtime() + 100000;
+    while(!*writeTimePtr && microtime() < deadline)
+      usleep(1);
+
+    if (!displayTime)
+      displayTime = microtime();
+
+    const uint32_t serial      = frame->frameSerial;
+    const uint64_t captureTime = frame->captureTime;
+    const uint64_t writeTime   = *writeTimePtr;
     lgmpClientMessageDone(frameQueue);
 
+    if (frameCount > 0 && serial - lastSerial > 1)
+      drops += serial - lastSerial - 1;
+    lastSerial = serial;
+
+#define LATENCY(p, latency) \
+    { \
+      const uint64_t _l = (latency); \
+      p.min = p.count ? min(p.min, _l) : _l; \
+      p.max = max(p.max, _l); \
+      p.ttl += _l; \
+      ++p.count; \
+    }
+
+    if (writeTime > captureTime)
+      LATENCY(writeLat, writeTime - captureTime);
+
+    const int64_t display = (int64_t)displayTime -
+      ((int64_t)captureTime + clockOffset);
+    if (display > 0)
+      LATENCY(displayLat, display);
+
+    if (displayTime - latencyStart >= 1000000)
+    {
+      if (writeLat.count)
+        fprintf(stdout, "capture->write   avg:%7.3f ms max:%7.3f ms\n",
+            ((float)writeLat.ttl / writeLat.count) / 1e3f,
+            (float)writeLat.max / 1e3f);
+
+      if (displayLat.count)
+        fprintf(stdout, "capture->display avg:%7.3f ms max:%7.3f ms, "
+            "dropped: %" PRIu64 "\n",
+            ((float)displayLat.ttl / displayLat.count) / 1e3f,
+            (float)displayLat.max / 1e3f,
+            drops);
+
+      hostStatsSample(hostStats, &hostNow);
+      hostStatsPrint(&hostLast, &hostNow);
+      hostLast = hostNow;
+
+      writeLat     = (struct perf){};
+      displayLat   = (struct perf){};
+      latencyStart = displayTime;
+    }
+
     uint64_t frameTime = nanotime();
     uint64_t diff = frameTime - lastFrameTime;
 
@@ -211,7 +392,7 @@ static int run(void)
 
 int main(int argc, char * argv[])
 {
-  DEBUG_INFO("Looking Glass (" BUILD_VERSION ") - Client Profiler");
+  DEBUG_INFO("Looking Glass (%s) - Client Profiler", BUILD_VERSION);
 
   if (!installCrashHandler("/proc/self/exe"))
     DEBUG_WARN("Failed to install the crash handler");
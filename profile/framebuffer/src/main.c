@@ -0,0 +1,467 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017-2021 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "common/debug.h"
+#include "common/version.h"
+#include "common/option.h"
+#include "common/crash.h"
+#include "common/framebuffer.h"
+#include "common/ivshmem.h"
+#include "common/thread.h"
+#include "common/time.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+enum BenchReader
+{
+  BENCH_READER_READ,
+  BENCH_READER_READ_FN
+};
+
+static const char * BenchReaderStr[] =
+{
+  [BENCH_READER_READ   ] = "read",
+  [BENCH_READER_READ_FN] = "read_fn"
+};
+
+struct bench
+{
+  FrameBuffer * frame;
+  uint8_t     * src;
+  uint8_t     * dst;
+  size_t        width, height, bpp, pitch;
+  unsigned int  frames;
+
+  enum BenchReader reader;
+  size_t           dstPos;
+
+  atomic_uint       posted;
+  atomic_uint       done;
+  _Atomic(uint64_t) start;
+
+  uint64_t   * latency;
+  uint64_t     readTime;
+  unsigned int timeouts;
+};
+
+static bool kernelValidator(struct Option * opt, const char ** error)
+{
+  for(FrameBufferKernel k = FB_KERNEL_AUTO; k < FB_KERNEL_MAX; ++k)
+    if (strcmp(opt->value.x_string, framebuffer_kernel_name(k)) == 0)
+      return true;
+
+  *error = "Invalid copy kernel, valid values are: auto, memcpy, sse4.1, erms, avx2 & avx512";
+  return false;
+}
+
+static bool readerValidator(struct Option * opt, const char ** error)
+{
+  if (strcmp(opt->value.x_string, "read"   ) == 0 ||
+      strcmp(opt->value.x_string, "read_fn") == 0 ||
+      strcmp(opt->value.x_string, "both"   ) == 0)
+    return true;
+
+  *error = "Invalid reader, valid values are: read, read_fn & both";
+  return false;
+}
+
+static bool positiveValidator(struct Option * opt, const char ** error)
+{
+  if (opt->value.x_int > 0)
+    return true;
+
+  *error = "The value must be greater than zero";
+  return false;
+}
+
+static bool notNegativeValidator(struct Option * opt, const char ** error)
+{
+  if (opt->value.x_int >= 0)
+    return true;
+
+  *error = "The value must not be negative";
+  return false;
+}
+
+static struct Option options[] =
+{
+  {
+    .module         = "bench",
+    .name           = "device",
+    .shortopt       = 'f',
+    .description    = "The shared memory file or kvmfr device to use, ie: /dev/shm/looking-glass or /dev/kvmfr0 (heap memory if not set)",
+    .type           = OPTION_TYPE_STRING,
+    .value.x_string = NULL
+  },
+  {
+    .module         = "bench",
+    .name           = "sizes",
+    .description    = "Comma separated list of resolutions to test",
+    .type           = OPTION_TYPE_STRING,
+    .value.x_string = "1920x1080,2560x1440,3840x2160"
+  },
+  {
+    .module         = "bench",
+    .name           = "bpp",
+    .description    = "The number of bytes per pixel",
+    .type           = OPTION_TYPE_INT,
+    .value.x_int    = 4,
+    .validator      = positiveValidator
+  },
+  {
+    .module         = "bench",
+    .name           = "padding",
+    .description    = "Extra bytes at the end of each row (pitch = width * bpp + padding)",
+    .type           = OPTION_TYPE_INT,
+    .value.x_int    = 0,
+    .validator      = notNegativeValidator
+  },
+  {
+    .module         = "bench",
+    .name           = "misalign",
+    .description    = "Offset in bytes of the source and destination buffers from a page boundary",
+    .type           = OPTION_TYPE_INT,
+    .value.x_int    = 0,
+    .validator      = notNegativeValidator
+  },
+  {
+    .module         = "bench",
+    .name           = "frames",
+    .description    = "The number of frames to transfer per test",
+    .type           = OPTION_TYPE_INT,
+    .value.x_int    = 300,
+    .validator      = positiveValidator
+  },
+  {
+    .module         = "bench",
+    .name           = "kernel",
+    .description    = "The copy kernel to use (auto, memcpy, sse4.1, erms, avx2, avx512)",
+    .type           = OPTION_TYPE_STRING,
+    .value.x_string = "auto",
+    .validator      = kernelValidator
+  },
+  {
+    .module         = "bench",
+    .name           = "threads",
+    .description    = "The number of threads framebuffer_write uses",
+    .type           = OPTION_TYPE_INT,
+    .value.x_int    = 1,
+    .validator      = positiveValidator
+  },
+  {
+    .module         = "bench",
+    .name           = "reader",
+    .description    = "The read method to test (read, read_fn, both)",
+    .type           = OPTION_TYPE_STRING,
+    .value.x_string = "both",
+    .validator      = readerValidator
+  },
+  {0}
+};
+
+static bool readFn(void * opaque, const void * src, size_t size)
+{
+  struct bench * b = (struct bench *)opaque;
+  memcpy(b->dst + b->dstPos, src, size);
+  b->dstPos += size;
+  return true;
+}
+
+static int consumerThread(void * opaque)
+{
+  struct bench * b = (struct bench *)opaque;
+
+  for(unsigned int i = 1; i <= b->frames; ++i)
+  {
+    while(atomic_load_explicit(&b->posted, memory_order_acquire) != i)
+      sched_yield();
+
+    const uint64_t start = atomic_load_explicit(&b->start, memory_order_relaxed);
+    const uint64_t rs    = nanotime();
+
+    bool ok;
+    if (b->reader == BENCH_READER_READ)
+      ok = framebuffer_read(b->frame, b->dst, b->pitch, b->height, b->width,
+          b->bpp, b->pitch);
+    else
+    {
+      b->dstPos = 0;
+      ok = framebuffer_read_fn(b->frame, b->height, b->width, b->bpp, b->pitch,
+          readFn, b);
+    }
+
+    const uint64_t end = nanotime();
+    if (!ok)
+      ++b->timeouts;
+
+    b->latency[i - 1] = end - start;
+    b->readTime      += end - rs;
+    atomic_store_explicit(&b->done, i, memory_order_release);
+  }
+
+  return 0;
+}
+
+static int compareU64(const void * a, const void * b)
+{
+  const uint64_t va = *(const uint64_t *)a;
+  const uint64_t vb = *(const uint64_t *)b;
+  return va < vb ? -1 : va > vb;
+}
+
+static double percentile(const uint64_t * sorted, unsigned int count, double p)
+{
+  unsigned int i = (unsigned int)(p * (count - 1) + 0.5);
+  return sorted[i] / 1000.0;
+}
+
+static bool runTest(struct bench * b, bool first)
+{
+  const size_t size = b->height * b->pitch;
+
+  b->timeouts = 0;
+  b->readTime = 0;
+  atomic_store(&b->posted, 0);
+  atomic_store(&b->done  , 0);
+
+  LGThread * thread;
+  if (!lgCreateThread("consumer", consumerThread, b, &thread))
+  {
+    DEBUG_ERROR("Failed to create the consumer thread");
+    return false;
+  }
+
+  uint64_t writeTime = 0;
+  const uint64_t start = nanotime();
+  for(unsigned int i = 1; i <= b->frames; ++i)
+  {
+    framebuffer_prepare(b->frame);
+
+    const uint64_t ws = nanotime();
+    atomic_store_explicit(&b->start , ws, memory_order_relaxed);
+    atomic_store_explicit(&b->posted, i , memory_order_release);
+    framebuffer_write(b->frame, b->src, size);
+    writeTime += nanotime() - ws;
+
+    // wait for the consumer so each frame is measured in isolation
+    while(atomic_load_explicit(&b->done, memory_order_acquire) != i)
+      sched_yield();
+  }
+  const uint64_t total = nanotime() - start;
+  lgJoinThread(thread, NULL);
+
+  // the row padding is not copied by framebuffer_read, only check the pixels
+  for(size_t y = 0; y < b->height; ++y)
+    if (memcmp(b->dst + y * b->pitch, b->src + y * b->pitch, b->width * b->bpp) != 0)
+    {
+      DEBUG_WARN("Data mismatch for %zux%zu using %s", b->width, b->height,
+          BenchReaderStr[b->reader]);
+      break;
+    }
+
+  qsort(b->latency, b->frames, sizeof(*b->latency), compareU64);
+
+  const double bytes = (double)size * b->frames;
+  fprintf(stdout,
+      "%s    {\n"
+      "      \"width\": %zu, \"height\": %zu, \"bpp\": %zu, \"pitch\": %zu,\n"
+      "      \"reader\": \"%s\", \"frames\": %u,\n"
+      "      \"gbps\": %.3f, \"write_gbps\": %.3f, \"read_gbps\": %.3f,\n"
+      "      \"latency_us\": { \"min\": %.1f, \"p50\": %.1f, \"p90\": %.1f, "
+      "\"p99\": %.1f, \"max\": %.1f },\n"
+      "      \"spin_timeouts\": %u\n"
+      "    }",
+      first ? "" : ",\n",
+      b->width, b->height, b->bpp, b->pitch,
+      BenchReaderStr[b->reader], b->frames,
+      bytes / total, bytes / writeTime, bytes / b->readTime,
+      b->latency[0] / 1000.0,
+      percentile(b->latency, b->frames, 0.50),
+      percentile(b->latency, b->frames, 0.90),
+      percentile(b->latency, b->frames, 0.99),
+      b->latency[b->frames - 1] / 1000.0,
+      b->timeouts);
+
+  return true;
+}
+
+static int run(struct IVSHMEM * shmDev)
+{
+  const long   pageSize = sysconf(_SC_PAGESIZE);
+  const size_t bpp      = option_get_int("bench", "bpp"     );
+  const size_t padding  = option_get_int("bench", "padding" );
+  const size_t misalign = option_get_int("bench", "misalign");
+  const char * readers  = option_get_string("bench", "reader");
+  const char * device   = option_get_string("bench", "device");
+  char       * sizes    = strdup(option_get_string("bench", "sizes"));
+
+  const char * kernelName = option_get_string("bench", "kernel");
+  for(FrameBufferKernel k = FB_KERNEL_AUTO; k < FB_KERNEL_MAX; ++k)
+    if (strcmp(kernelName, framebuffer_kernel_name(k)) == 0)
+    {
+      if (!framebuffer_set_kernel(k))
+      {
+        DEBUG_ERROR("The %s copy kernel is not supported by this CPU", kernelName);
+        free(sizes);
+        return -1;
+      }
+      break;
+    }
+
+  const int threads = option_get_int("bench", "threads");
+  if (!framebuffer_set_write_threads(threads))
+  {
+    free(sizes);
+    return -1;
+  }
+
+  fprintf(stdout,
+      "{\n"
+      "  \"kernel\": \"%s\",\n"
+      "  \"threads\": %d,\n"
+      "  \"device\": \"%s\",\n"
+      "  \"misalign\": %zu,\n"
+      "  \"results\": [\n",
+      framebuffer_kernel_name(framebuffer_get_kernel()),
+      threads,
+      device ? device : "heap",
+      misalign);
+
+  int  ret   = 0;
+  bool first = true;
+  for(char * save, * tok = strtok_r(sizes, ",", &save); tok;
+      tok = strtok_r(NULL, ",", &save))
+  {
+    struct bench b = { .frames = option_get_int("bench", "frames") };
+    if (sscanf(tok, "%zux%zu", &b.width, &b.height) != 2 || !b.width || !b.height)
+    {
+      DEBUG_ERROR("Invalid resolution: %s", tok);
+      ret = -1;
+      break;
+    }
+
+    b.bpp   = bpp;
+    b.pitch = b.width * bpp + padding;
+
+    // place the frame data on a page boundary, as the host application does
+    const size_t frameSize = pageSize + b.height * b.pitch;
+    uint8_t    * frameMem  = NULL;
+    if (shmDev)
+    {
+      if (frameSize > shmDev->size)
+      {
+        DEBUG_ERROR("%s is too small for %zux%zu", device, b.width, b.height);
+        ret = -1;
+        break;
+      }
+      frameMem = shmDev->mem;
+    }
+    else if (!(frameMem = aligned_alloc(pageSize, frameSize)))
+    {
+      DEBUG_ERROR("Out of memory");
+      ret = -1;
+      break;
+    }
+
+    const size_t bufSize = pageSize + b.height * b.pitch;
+    uint8_t    * srcMem  = aligned_alloc(pageSize, bufSize);
+    uint8_t    * dstMem  = aligned_alloc(pageSize, bufSize);
+    b.latency = malloc(sizeof(*b.latency) * b.frames);
+    if (!srcMem || !dstMem || !b.latency)
+    {
+      DEBUG_ERROR("Out of memory");
+      ret = -1;
+    }
+    else
+    {
+      b.frame = (FrameBuffer *)(frameMem + pageSize - FrameBufferStructSize);
+      b.src   = srcMem + misalign % pageSize;
+      b.dst   = dstMem + misalign % pageSize;
+
+      for(size_t i = 0; i < b.height * b.pitch; ++i)
+        b.src[i] = rand();
+
+      for(enum BenchReader r = BENCH_READER_READ; r <= BENCH_READER_READ_FN; ++r)
+      {
+        if (strcmp(readers, "both") != 0 && strcmp(readers, BenchReaderStr[r]) != 0)
+          continue;
+
+        b.reader = r;
+        memset(dstMem, 0, bufSize);
+        if (!runTest(&b, first))
+        {
+          ret = -1;
+          break;
+        }
+        first = false;
+      }
+    }
+
+    free(b.latency);
+    free(dstMem);
+    free(srcMem);
+    if (!shmDev)
+      free(frameMem);
+
+    if (ret != 0)
+      break;
+  }
+
+  fprintf(stdout, "\n  ]\n}\n");
+  framebuffer_set_write_threads(1);
+  free(sizes);
+  return ret;
+}
+
+int main(int argc, char * argv[])
+{
+  DEBUG_INFO("Looking Glass (%s) - FrameBuffer Profiler", BUILD_VERSION);
+
+  if (!installCrashHandler("/proc/self/exe"))
+    DEBUG_WARN("Failed to install the crash handler");
+
+  option_register(options);
+  if (!option_parse(argc, argv) || !option_validate())
+  {
+    option_free();
+    return -1;
+  }
+
+  int ret = -1;
+  const char * device = option_get_string("bench", "device");
+  if (device)
+  {
+    struct IVSHMEM shmDev;
+    if (ivshmemOpenDev(&shmDev, device))
+    {
+      ret = run(&shmDev);
+      ivshmemClose(&shmDev);
+    }
+  }
+  else
+    ret = run(NULL);
+
+  option_free();
+  return ret;
+}